@@ -0,0 +1,4189 @@
+// C++ port of bin/nyns.sh, with minimal external dependencies.
+//
+// This is the interpreter library; bin/nyns.h declares its C interface and
+// bin/nyns.cpp is the command-line front end built on top of it.
+
+#include "nyns.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+// perror() equivalent that writes to the given stream instead of stderr.
+static void report_errno(std::ostream &err, const std::string &what) {
+    int saved = errno;
+    err << what << ": " << std::strerror(saved) << '\n';
+}
+
+// Batched unlinkat() through io_uring, driven by raw syscalls. One
+// io_uring_enter() submits a whole batch and waits for all of it, instead
+// of one syscall per file. usable() is false when the kernel lacks
+// io_uring or IORING_OP_UNLINKAT (before 5.11), or when it is blocked by a
+// sandbox, and callers then unlink synchronously. A ring belongs to one
+// thread.
+class UnlinkRing {
+public:
+    static constexpr unsigned ENTRIES = 1024;
+
+    UnlinkRing() {
+        io_uring_params params{};
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, ENTRIES, &params));
+        if (fd_ < 0) {
+            return;
+        }
+        if (!supports_unlinkat() || !map(params)) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    UnlinkRing(const UnlinkRing &) = delete;
+    UnlinkRing &operator=(const UnlinkRing &) = delete;
+
+    ~UnlinkRing() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != MAP_FAILED) {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool usable() const { return fd_ >= 0; }
+
+    unsigned capacity() const { return sq_entries_; }
+
+    // Unlinks up to capacity() names relative to `dirfd` and calls
+    // done(index, errno_or_0) once for each of them. Names the ring could
+    // not submit, or whose completions could not be waited for, are
+    // unlinked synchronously, and the ring is then given up so that no
+    // late completion can be taken for a later batch's.
+    template <typename DoneFn>
+    void unlink_all(int dirfd, const std::vector<std::string> &names, DoneFn &&done) {
+        auto count = static_cast<unsigned>(names.size());
+        unsigned tail = *sq_tail_;
+        for (unsigned i = 0; i < count; ++i) {
+            unsigned idx = tail & *sq_mask_;
+            io_uring_sqe &sqe = sqes_[idx];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_UNLINKAT;
+            sqe.fd = dirfd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(names[i].c_str());
+            sqe.user_data = i;
+            sq_array_[idx] = idx;
+            ++tail;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        long submitted;
+        do {
+            submitted = syscall(__NR_io_uring_enter, fd_, count, count, IORING_ENTER_GETEVENTS,
+                                nullptr, 0);
+        } while (submitted < 0 && errno == EINTR);
+        if (submitted < 0) {
+            submitted = 0;
+        }
+
+        unsigned reaped = 0;
+        bool stranded = false; // Submitted entries were left unreaped
+        std::vector<bool> completed(count);
+        while (reaped < submitted) {
+            unsigned head = *cq_head_;
+            unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            if (head == cq_tail) {
+                if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                    errno != EINTR) {
+                    stranded = true;
+                    break;
+                }
+                continue;
+            }
+            for (; head != cq_tail; ++head, ++reaped) {
+                const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+                auto i = static_cast<std::size_t>(cqe.user_data);
+                completed[i] = true;
+                done(i, cqe.res < 0 ? -cqe.res : 0);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+
+        if (stranded || submitted < count) {
+            for (unsigned i = 0; i < count; ++i) {
+                if (completed[i]) {
+                    continue;
+                }
+                int error = unlinkat(dirfd, names[i].c_str(), 0) == 0 ? 0 : errno;
+                // A stranded entry may have been carried out all the same.
+                if (error == ENOENT && i < submitted) {
+                    error = 0;
+                }
+                done(i, error);
+            }
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+private:
+    bool supports_unlinkat() {
+        constexpr unsigned OPS = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op));
+        auto *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, OPS) < 0) {
+            return false;
+        }
+        return IORING_OP_UNLINKAT <= probe->last_op &&
+               (probe->ops[IORING_OP_UNLINKAT].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    bool map(const io_uring_params &params) {
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                       IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            return false;
+        }
+        cq_ptr_ = single ? sq_ptr_
+                         : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            return false;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+        auto *sq = static_cast<char *>(sq_ptr_);
+        auto *cq = static_cast<char *>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        sq_entries_ = params.sq_entries;
+        return true;
+    }
+
+    int fd_ = -1;
+    void *sq_ptr_ = MAP_FAILED;
+    void *cq_ptr_ = MAP_FAILED;
+    io_uring_sqe *sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+    std::size_t sq_size_ = 0;
+    std::size_t cq_size_ = 0;
+    std::size_t sqes_size_ = 0;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_mask_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned *cq_mask_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+    unsigned sq_entries_ = 0;
+};
+
+// Deletes directory trees through directory fds. Every entry is named
+// relative to its parent's fd, so the kernel never walks a long path again,
+// and d_type from readdir() makes fstatat() necessary only for DT_UNKNOWN.
+// Neither PATH_MAX nor the fd limit bounds the depth of a tree.
+//
+// Each directory is a task: a worker opens it, unlinks the entries that are
+// not directories and queues the subdirectories on its own deque. Workers
+// take their newest task first, staying depth-first, and an idle worker
+// steals the oldest task of another, which is the largest subtree left.
+// 'rem -j N' runs N workers; plain 'rem' runs one on the calling thread.
+// A directory keeps its fd open and counts its unfinished subdirectories,
+// and whichever worker finishes the last of them removes it. Subtrees below
+// MAX_TASK_DEPTH are cleared inline (see clear_subtree()), which keeps the
+// number of open fds bounded. Files are unlinked in batches through each
+// worker's UnlinkRing when the kernel allows it; a worker only sets its ring
+// up once a directory has MIN_RING_BATCH files.
+class TreeRemover {
+public:
+    TreeRemover(unsigned workers, bool force, std::ostream &err)
+        : queues_(std::max(1u, workers)), rings_(queues_.size()), force_(force), err_(err) {}
+
+    // Makes remove() stat every file so print_stats() can report the space
+    // freed, which costs one fstatat() per file.
+    void count_bytes() { count_bytes_ = true; }
+
+    // Removes `path`, relative to `dirfd`. `display` names it in messages.
+    bool remove(int dirfd, const std::string &path, const std::string &display) {
+        root_fd_ = dirfd;
+        root_display_ = display;
+        struct stat st{};
+        if (fstatat(dirfd, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno == ENOENT && force_) {
+                return true;
+            }
+            report("Error stating '" + display + "'");
+            return false;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            if (unlinkat(dirfd, path.c_str(), 0) != 0) {
+                report("Error removing file '" + display + "'", !force_);
+                return force_;
+            }
+            ++files_;
+            bytes_ += count_bytes_ ? static_cast<std::uint64_t>(st.st_blocks) * 512 : 0;
+            return true;
+        }
+
+        outstanding_ = 1;
+        queued_ = 1;
+        queues_[0].tasks.push_back(new DirTask{nullptr, path, -1, 0, {1}});
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            // Workers that never start leave their deques empty, so the
+            // ones that did finish the tree between them.
+            try {
+                threads.emplace_back(&TreeRemover::work, this, i);
+            } catch (const std::system_error &) {
+                break;
+            }
+        }
+        work(0);
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        return force_ || !root_failed_;
+    }
+
+    // One line covering everything remove() has done so far.
+    void print_stats(std::ostream &os, double elapsed_ms) const {
+        std::uint64_t entries = files_ + dirs_;
+        char line[160];
+        std::snprintf(line, sizeof(line),
+                      "rem: %llu files, %llu directories, %.1f MiB freed in %.3f ms "
+                      "(%.0f entries/s), ",
+                      static_cast<unsigned long long>(files_.load()),
+                      static_cast<unsigned long long>(dirs_.load()),
+                      static_cast<double>(bytes_) / (1024.0 * 1024.0), elapsed_ms,
+                      elapsed_ms > 0 ? static_cast<double>(entries) * 1000.0 / elapsed_ms : 0.0);
+        os << line;
+        print_errors(os);
+        os << '\n';
+    }
+
+    // Accounts for the errors beyond the cap that were counted but not shown.
+    void print_hidden_errors(std::ostream &os) const {
+        if (error_count_ > ERROR_REPORT_CAP) {
+            os << "rem: ";
+            print_errors(os);
+            os << ", only the first " << ERROR_REPORT_CAP << " shown\n";
+        }
+    }
+
+private:
+    static constexpr unsigned MAX_TASK_DEPTH = 32;
+    static constexpr std::size_t ERROR_REPORT_CAP = 20;
+    // Below this many files a batch is cheaper as plain unlinkat() calls.
+    static constexpr std::size_t MIN_RING_BATCH = 16;
+
+    struct DirTask {
+        DirTask *parent;
+        std::string name; // Relative to the parent's fd
+        int fd;           // Open from listing until removal
+        unsigned depth;
+        std::atomic<std::size_t> pending; // Unfinished subdirectories, +1 while listing
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<DirTask *> tasks;
+    };
+
+    static std::string join(std::string dir, std::string_view name) {
+        if (dir.empty() || dir.back() != '/') {
+            dir += '/';
+        }
+        dir += name;
+        return dir;
+    }
+
+    // Full path for messages only; the removal itself never builds one.
+    std::string display_path(const DirTask *task) const {
+        return task->parent ? join(display_path(task->parent), task->name) : root_display_;
+    }
+
+    int parent_fd(const DirTask *task) const {
+        return task->parent ? task->parent->fd : root_fd_;
+    }
+
+    void work(std::size_t self) {
+        while (outstanding_ > 0) {
+            DirTask *task = take(self);
+            if (!task) {
+                std::unique_lock<std::mutex> lock(idle_mutex_);
+                ++idle_;
+                idle_cv_.wait_for(lock, std::chrono::milliseconds(1),
+                                  [this] { return queued_ > 0 || outstanding_ == 0; });
+                --idle_;
+                continue;
+            }
+            process(self, task);
+        }
+        idle_cv_.notify_all();
+    }
+
+    DirTask *take(std::size_t self) {
+        {
+            WorkQueue &own = queues_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                DirTask *task = own.tasks.back();
+                own.tasks.pop_back();
+                --queued_;
+                return task;
+            }
+        }
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            WorkQueue &victim = queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                DirTask *task = victim.tasks.front();
+                victim.tasks.pop_front();
+                --queued_;
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void process(std::size_t self, DirTask *task) {
+        task->fd = openat(parent_fd(task), task->name.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (task->fd < 0) {
+            report("Error opening directory '" + display_path(task) + "'");
+        } else if (task->depth >= MAX_TASK_DEPTH) {
+            clear_subtree(self, task);
+        } else {
+            std::vector<std::string> subdirs;
+            clear_directory(self, task->fd, subdirs, [&] { return display_path(task); });
+            if (!subdirs.empty()) {
+                task->pending += subdirs.size();
+                outstanding_ += subdirs.size();
+                {
+                    WorkQueue &own = queues_[self];
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    for (std::string &name : subdirs) {
+                        own.tasks.push_back(
+                            new DirTask{task, std::move(name), -1, task->depth + 1, {1}});
+                    }
+                }
+                queued_ += subdirs.size();
+                if (idle_ > 0) {
+                    idle_cv_.notify_all();
+                }
+            }
+        }
+        finish(task);
+    }
+
+    // Unlinks every entry of the open directory `fd` that is not itself a
+    // directory and appends the names of its subdirectories to `subdirs`.
+    // `where` produces the directory's path, and is only called for errors.
+    template <typename WhereFn>
+    void clear_directory(std::size_t self, int fd, std::vector<std::string> &subdirs,
+                         WhereFn &&where) {
+        // fdopendir() takes over the fd it is given, and `fd` must stay open.
+        int listing = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        DIR *dir = listing >= 0 ? fdopendir(listing) : nullptr;
+        if (!dir) {
+            report("Error opening directory '" + where() + "'");
+            if (listing >= 0) {
+                close(listing);
+            }
+            return;
+        }
+
+        // Setting a ring up costs several syscalls and mappings, so it is
+        // only done once a directory holds a batch worth submitting.
+        auto batch_ring = [&]() -> UnlinkRing * {
+            if (!rings_[self]) {
+                rings_[self] = std::make_unique<UnlinkRing>();
+            }
+            return rings_[self]->usable() ? rings_[self].get() : nullptr;
+        };
+        std::vector<std::string> files;
+        std::vector<std::uint64_t> sizes; // Parallel to `files` when counting bytes
+        auto unlinked = [&](std::string_view name, std::uint64_t size, int error) {
+            if (error == 0) {
+                ++files_;
+                bytes_ += size;
+            } else if (error != ENOENT || !force_) {
+                errno = error;
+                report("Error removing file '" + join(where(), name) + "'", !force_);
+            }
+        };
+        auto unlink_files = [&]() {
+            auto done = [&](std::size_t i, int error) {
+                unlinked(files[i], count_bytes_ ? sizes[i] : 0, error);
+            };
+            if (UnlinkRing *ring = files.size() >= MIN_RING_BATCH ? batch_ring() : nullptr) {
+                ring->unlink_all(fd, files, done);
+            } else {
+                for (std::size_t i = 0; i < files.size(); ++i) {
+                    done(i, unlinkat(fd, files[i].c_str(), 0) == 0 ? 0 : errno);
+                }
+            }
+            files.clear();
+            sizes.clear();
+        };
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            const char *name = entry->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+            unsigned char type = entry->d_type;
+            std::uint64_t size = 0;
+            if (type == DT_UNKNOWN || (count_bytes_ && type != DT_DIR)) {
+                struct stat st{};
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    // With -f, as for rm -f, an entry already gone is no error.
+                    if (errno != ENOENT || !force_) {
+                        report("Error stating '" + join(where(), name) + "'", !force_);
+                    }
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+                size = static_cast<std::uint64_t>(st.st_blocks) * 512;
+            }
+            if (type == DT_DIR) {
+                subdirs.emplace_back(name);
+            } else if (rings_[self] && !rings_[self]->usable()) {
+                unlinked(name, size, unlinkat(fd, name, 0) == 0 ? 0 : errno);
+            } else {
+                files.emplace_back(name);
+                if (count_bytes_) {
+                    sizes.push_back(size);
+                }
+                if (files.size() >= MIN_RING_BATCH) {
+                    UnlinkRing *ring = batch_ring();
+                    if (!ring || files.size() == ring->capacity()) {
+                        unlink_files();
+                    }
+                }
+            }
+        }
+        unlink_files();
+        closedir(dir);
+    }
+
+    // Removes everything below `task` on this thread while holding at most
+    // two fds: after a subdirectory is cleared the walk climbs back to its
+    // parent through "..", checked against the device and inode it came
+    // from in case the tree was moved meanwhile.
+    void clear_subtree(std::size_t self, DirTask *task) {
+        struct Frame {
+            std::string name;
+            std::vector<std::string> subdirs;
+            dev_t dev;
+            ino_t ino;
+        };
+        std::vector<Frame> stack(1);
+        auto where = [&]() {
+            std::string path = display_path(task);
+            for (std::size_t i = 1; i < stack.size(); ++i) {
+                path = join(std::move(path), stack[i].name);
+            }
+            return path;
+        };
+        struct stat st{};
+        fstat(task->fd, &st);
+        stack[0].dev = st.st_dev;
+        stack[0].ino = st.st_ino;
+        clear_directory(self, task->fd, stack[0].subdirs, where);
+
+        int cur = task->fd;
+        for (;;) {
+            Frame &top = stack.back();
+            if (!top.subdirs.empty()) {
+                std::string name = std::move(top.subdirs.back());
+                top.subdirs.pop_back();
+                int child = openat(cur, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (child < 0 || fstat(child, &st) != 0) {
+                    report("Error opening directory '" + join(where(), name) + "'");
+                    if (child >= 0) {
+                        close(child);
+                    }
+                    continue;
+                }
+                if (cur != task->fd) {
+                    close(cur);
+                }
+                cur = child;
+                stack.push_back(Frame{std::move(name), {}, st.st_dev, st.st_ino});
+                clear_directory(self, cur, stack.back().subdirs, where);
+                continue;
+            }
+            if (stack.size() == 1) {
+                break; // finish() removes the task's own directory
+            }
+
+            std::string done = where();
+            std::string name = std::move(top.name);
+            stack.pop_back();
+            int parent = task->fd;
+            if (stack.size() > 1) {
+                parent = openat(cur, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (parent < 0 || fstat(parent, &st) != 0 || st.st_dev != stack.back().dev ||
+                    st.st_ino != stack.back().ino) {
+                    errno = parent < 0 ? errno : ESTALE;
+                    report("Error returning from '" + done + "'");
+                    if (parent >= 0) {
+                        close(parent);
+                    }
+                    close(cur);
+                    return;
+                }
+            }
+            close(cur);
+            cur = parent;
+            if (unlinkat(cur, name.c_str(), AT_REMOVEDIR) == 0) {
+                ++dirs_;
+            } else {
+                report("Error removing directory '" + done + "'", !force_);
+            }
+        }
+    }
+
+    // Drops the listing's hold on `task`, removing it and then any parents
+    // whose last subdirectory it was.
+    void finish(DirTask *task) {
+        while (task && --task->pending == 0) {
+            if (task->fd >= 0) {
+                close(task->fd);
+            }
+            if (unlinkat(parent_fd(task), task->name.c_str(), AT_REMOVEDIR) == 0) {
+                ++dirs_;
+            } else {
+                report("Error removing directory '" + display_path(task) + "'", !force_);
+                if (!task->parent) {
+                    root_failed_ = true;
+                }
+            }
+            DirTask *parent = task->parent;
+            delete task;
+            --outstanding_;
+            task = parent;
+        }
+    }
+
+    // Prints the first ERROR_REPORT_CAP errors and counts all of them, so a
+    // tree full of unremovable entries cannot flood the error output. With
+    // `print` false (rem -f) the error is only counted, for print_stats().
+    void report(const std::string &what, bool print = true) {
+        int saved = errno;
+        std::lock_guard<std::mutex> lock(err_mutex_);
+        ++errors_by_errno_[saved];
+        if (++error_count_ <= ERROR_REPORT_CAP && print) {
+            errno = saved;
+            report_errno(err_, what);
+        }
+    }
+
+    // "3 errors (Permission denied: 2, Directory not empty: 1)"
+    void print_errors(std::ostream &os) const {
+        os << error_count_ << (error_count_ == 1 ? " error" : " errors");
+        const char *sep = " (";
+        for (const auto &entry : errors_by_errno_) {
+            os << sep << std::strerror(entry.first) << ": " << entry.second;
+            sep = ", ";
+        }
+        if (!errors_by_errno_.empty()) {
+            os << ')';
+        }
+    }
+
+    std::vector<WorkQueue> queues_;
+    std::vector<std::unique_ptr<UnlinkRing>> rings_; // Per worker, created at its first full batch
+    bool force_;
+    std::ostream &err_;
+    std::mutex err_mutex_;
+    int root_fd_ = AT_FDCWD;
+    std::string root_display_;
+    std::atomic<std::size_t> outstanding_{0}; // Directories not yet removed
+    std::atomic<std::size_t> queued_{0};      // Directories waiting in a deque
+    std::atomic<bool> root_failed_{false};
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::atomic<unsigned> idle_{0};
+    bool count_bytes_ = false;
+    std::atomic<std::uint64_t> files_{0};
+    std::atomic<std::uint64_t> dirs_{0};
+    std::atomic<std::uint64_t> bytes_{0};
+    std::size_t error_count_ = 0; // Guarded by err_mutex_, like the map
+    std::map<int, std::size_t> errors_by_errno_;
+};
+
+// 'rem -defer' renames its target into this directory, next to the target
+// and so on the same filesystem, and deletes it from there in the background.
+static constexpr char TRASH_DIR[] = ".nyns-trash";
+
+// One directory on the reclaimer's way down a tree. `resume` is the
+// listing offset just past the entry being descended into.
+struct ReclaimFrame {
+    dev_t dev;
+    ino_t ino;
+    off_t resume;
+    bool progress; // Something was removed in the current pass
+    char name[NAME_MAX + 1];
+};
+
+// The reclaimer only runs in a child forked from a process that may have
+// other threads, where only async-signal-safe calls are allowed: so it
+// formats and parses numbers itself.
+static char *format_decimal(char *out, unsigned long value) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    *out = '\0';
+    return out;
+}
+
+// Deletes the entries of the directory `root` whose names start with
+// `prefix`, and everything below them, with raw syscalls only: no
+// allocation besides an mmap(), no streams, no threads. A directory is
+// listed in passes, each descent resuming its parent's listing where it
+// left off, and listed again from the start after any pass that removed
+// something, until a pass removes nothing. Like
+// TreeRemover::clear_subtree(), the walk holds at most two fds and climbs
+// back through "..", checked against the device and inode it came from.
+// Anything deeper than RECLAIM_MAX_DEPTH is left in place.
+static void reclaim_entries(int root, const char *prefix) {
+    static constexpr std::size_t RECLAIM_MAX_DEPTH = 1 << 16;
+    std::size_t frames_size = RECLAIM_MAX_DEPTH * sizeof(ReclaimFrame);
+    void *mem = mmap(nullptr, frames_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        return;
+    }
+    auto *frames = static_cast<ReclaimFrame *>(mem);
+    std::size_t prefix_len = std::strlen(prefix);
+    alignas(dirent64) char buf[32768];
+
+    std::size_t depth = 0;
+    int cur = root;
+    frames[0].resume = 0;
+    frames[0].progress = false;
+    for (;;) {
+        ReclaimFrame &top = frames[depth];
+        bool descended = false;
+        lseek(cur, top.resume, SEEK_SET);
+        long n;
+        while (!descended && (n = syscall(SYS_getdents64, cur, buf, sizeof(buf))) > 0) {
+            for (long pos = 0; pos < n && !descended;) {
+                auto *entry = reinterpret_cast<dirent64 *>(buf + pos);
+                pos += entry->d_reclen;
+                const char *name = entry->d_name;
+                if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0 ||
+                    (depth == 0 && std::strncmp(name, prefix, prefix_len) != 0)) {
+                    continue;
+                }
+                if (entry->d_type != DT_DIR) {
+                    if (unlinkat(cur, name, 0) == 0) {
+                        top.progress = true;
+                        continue;
+                    }
+                    if (errno != EISDIR) {
+                        continue;
+                    }
+                }
+                if (depth + 1 >= RECLAIM_MAX_DEPTH) {
+                    continue;
+                }
+                int child = openat(cur, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                struct stat st{};
+                if (child < 0 || fstat(child, &st) != 0) {
+                    if (child >= 0) {
+                        close(child);
+                    }
+                    continue;
+                }
+                top.resume = entry->d_off;
+                ReclaimFrame &next = frames[depth + 1];
+                next.dev = st.st_dev;
+                next.ino = st.st_ino;
+                next.resume = 0;
+                next.progress = false;
+                std::memcpy(next.name, name, std::strlen(name) + 1);
+                if (cur != root) {
+                    close(cur);
+                }
+                cur = child;
+                ++depth;
+                descended = true;
+            }
+        }
+        if (descended) {
+            continue;
+        }
+        if (top.progress) {
+            top.progress = false;
+            top.resume = 0;
+            continue;
+        }
+        if (depth == 0) {
+            break;
+        }
+
+        // Climb back and remove the directory just emptied, if it was.
+        int parent = root;
+        if (depth > 1) {
+            struct stat st{};
+            parent = openat(cur, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (parent < 0 || fstat(parent, &st) != 0 || st.st_dev != frames[depth - 1].dev ||
+                st.st_ino != frames[depth - 1].ino) {
+                if (parent >= 0) {
+                    close(parent);
+                }
+                break;
+            }
+        }
+        close(cur);
+        cur = parent;
+        --depth;
+        if (unlinkat(cur, top.name, AT_REMOVEDIR) == 0) {
+            frames[depth].progress = true;
+        }
+    }
+    if (cur != root) {
+        close(cur);
+    }
+    munmap(mem, frames_size);
+}
+
+// Deletes everything in the trash directory `trash_fd` from a detached
+// grandchild, which outlives the script and never needs to be reaped. The
+// grandchild keeps no other descriptors: an inherited pipe would otherwise
+// stay open, and whoever reads our output would wait for the deletion.
+// Each entry is first claimed by renaming it to "reclaim.<pid>.<n>", so two
+// reclaimers never work on the same tree; entries claimed by a reclaimer
+// that has since died are taken over. The trash directory itself is then
+// removed from `parent_fd` unless something new has been moved into it.
+// Everything after fork() is async-signal-safe (see reclaim_entries()).
+static void reclaim_in_background(int parent_fd, int trash_fd, std::ostream &err) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        report_errno(err, "Error starting background deletion");
+        return;
+    }
+    if (pid > 0) {
+        while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {
+        }
+        return;
+    }
+
+    setsid();
+    if (fork() != 0) {
+        _exit(0);
+    }
+    // Trash on fd 3 and its parent on fd 4, moved clear of each other first.
+    int trash = fcntl(trash_fd, F_DUPFD, 5);
+    int parent = fcntl(parent_fd, F_DUPFD, 5);
+    dup2(trash, 3);
+    dup2(parent, 4);
+    if (syscall(SYS_close_range, 5u, ~0u, 0u) != 0) {
+        struct rlimit limit{};
+        int max = syscall(SYS_prlimit64, 0, RLIMIT_NOFILE, nullptr, &limit) == 0 &&
+                          limit.rlim_cur < 65536
+                      ? static_cast<int>(limit.rlim_cur)
+                      : 65536;
+        for (int fd = 5; fd < max; ++fd) {
+            close(fd);
+        }
+    }
+    int null_fd = ::open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3; ++fd) {
+        dup2(null_fd, fd);
+    }
+    close(null_fd);
+
+    static constexpr char PREFIX[] = "reclaim.";
+    constexpr std::size_t PREFIX_LEN = sizeof(PREFIX) - 1;
+    char own[PREFIX_LEN + 48];
+    std::memcpy(own, PREFIX, PREFIX_LEN);
+    char *own_end = format_decimal(own + PREFIX_LEN, static_cast<unsigned long>(getpid()));
+    *own_end++ = '.';
+    *own_end = '\0';
+
+    alignas(dirent64) char buf[32768];
+    unsigned long claimed = 0;
+    long n;
+    while ((n = syscall(SYS_getdents64, 3, buf, sizeof(buf))) > 0) {
+        for (long pos = 0; pos < n;) {
+            auto *entry = reinterpret_cast<dirent64 *>(buf + pos);
+            pos += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+            if (std::strncmp(name, PREFIX, PREFIX_LEN) == 0) {
+                long owner = 0;
+                for (const char *p = name + PREFIX_LEN; *p >= '0' && *p <= '9' && owner < 1 << 22; ++p) {
+                    owner = owner * 10 + (*p - '0');
+                }
+                if (owner > 0 && (kill(static_cast<pid_t>(owner), 0) == 0 || errno != ESRCH)) {
+                    continue;
+                }
+            }
+            format_decimal(own_end, claimed);
+            if (renameat(3, name, 3, own) == 0) {
+                ++claimed;
+            }
+        }
+    }
+    *own_end = '\0';
+    reclaim_entries(3, own);
+    unlinkat(4, TRASH_DIR, AT_REMOVEDIR);
+    _exit(0);
+}
+
+// Whether an existing trash directory is safe to move data into: in a
+// shared directory such as /tmp, one made by another user could let them
+// read what was moved there before it is deleted.
+static bool trusted_trash(int trash_fd) {
+    struct stat st{};
+    return fstat(trash_fd, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid() &&
+           (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Moves `path` out of the way with a single rename and leaves the deletion
+// to reclaim_in_background(). Returns false, without reporting anything,
+// when the path cannot be moved, e.g. because it is a mount point or the
+// trash directory next to it belongs to someone else; the caller then
+// deletes it synchronously.
+static bool defer_removal(int dirfd, std::string path, std::ostream &err) {
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    std::size_t slash = path.rfind('/');
+    std::string parent = slash == std::string::npos ? "." : path.substr(0, std::max<std::size_t>(slash, 1));
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    if (base.empty() || base == "." || base == ".." || base == TRASH_DIR) {
+        return false;
+    }
+
+    int parent_fd = openat(dirfd, parent.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    struct stat st{};
+    if (parent_fd < 0 || fstatat(parent_fd, base.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        if (parent_fd >= 0) {
+            close(parent_fd);
+        }
+        return false;
+    }
+    bool created = mkdirat(parent_fd, TRASH_DIR, 0700) == 0;
+    int trash_fd = openat(parent_fd, TRASH_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    static std::atomic<unsigned> serial{0};
+    std::string name = std::to_string(getpid()) + '.' + std::to_string(serial++);
+    bool moved = trash_fd >= 0 && trusted_trash(trash_fd) &&
+                 renameat(parent_fd, base.c_str(), trash_fd, name.c_str()) == 0;
+    if (moved) {
+        reclaim_in_background(parent_fd, trash_fd, err);
+    } else if (created) {
+        // Fails, as it should, if another 'rem -defer' has moved into it since.
+        unlinkat(parent_fd, TRASH_DIR, AT_REMOVEDIR);
+    }
+    close(parent_fd);
+    if (trash_fd >= 0) {
+        close(trash_fd);
+    }
+    return moved;
+}
+
+static bool mkdir_p(const std::string &path, std::ostream &err) {
+    if (path.empty() || path == ".") {
+        return true;
+    }
+    if (path == "/") {
+        return true;
+    }
+
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0) {
+        return S_ISDIR(st.st_mode);
+    }
+
+    std::size_t pos = path.rfind('/');
+    if (pos != std::string::npos && pos > 0) {
+        std::string parent = path.substr(0, pos);
+        if (!mkdir_p(parent, err)) {
+            return false;
+        }
+    }
+
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        report_errno(err, "Error creating directory '" + path + "'");
+        return false;
+    }
+    return true;
+}
+
+static bool is_block_device(const std::string &path) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    return S_ISBLK(st.st_mode);
+}
+
+struct PartitionEntry {
+    std::uint8_t boot_indicator;
+    std::uint8_t start_chs[3];
+    std::uint8_t partition_type;
+    std::uint8_t end_chs[3];
+    std::uint32_t start_lba;
+    std::uint32_t size_sectors;
+} __attribute__((packed));
+
+static constexpr std::size_t MBR_PART_TABLE_OFFSET = 446;
+static constexpr std::size_t MBR_MAX_PARTITIONS = 4;
+
+struct FileId {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const FileId &other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct FileIdHash {
+    std::size_t operator()(const FileId &id) const {
+        return std::hash<std::uint64_t>()(static_cast<std::uint64_t>(id.ino) * 31u +
+                                          static_cast<std::uint64_t>(id.dev));
+    }
+};
+
+// A script that is currently executing, for import cycle detection.
+struct ActiveScript {
+    FileId id;
+    std::string canonical_path;
+};
+
+struct ScriptTable;
+
+// A child's standard output or error, read through a pipe when it cannot
+// just inherit ours: when the interpreter's own stream goes to a callback,
+// or when 'adm -capture' collects it.
+struct ChildStream {
+    int fd = -1;                    // Our end of the pipe; -1 when inherited or closed
+    int child_fd = -1;              // The child's end, until it has been spawned
+    std::ostream *relay = nullptr;  // Forwarded here as it arrives, or
+    std::string *capture = nullptr; // collected here
+};
+
+// A command started by 'adm' in the background.
+struct Job {
+    std::string name;
+    std::string command;      // argv[0]
+    std::string command_line; // Whole argv, for the usage table
+    pid_t pid = -1;
+    int pidfd = -1; // -1 when the kernel has no pidfd_open
+    std::chrono::steady_clock::time_point started;
+    bool running = true;
+    int status = 0; // waitpid() status once it has finished
+    ChildStream output[2]; // Its stdout and stderr
+};
+
+// Resources used by one finished 'adm' command, from wait4().
+struct AdmUsage {
+    std::string command_line;
+    double wall_ms;
+    double user_ms;
+    double sys_ms;
+    long max_rss_kib;
+    long blocks_in;
+    long blocks_out;
+};
+
+// What drawing the TUI cost during one run.
+struct FrameStats {
+    std::uint64_t frames = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t writes = 0;
+};
+
+// Stream buffer behind an interpreter's output and error streams. Text is
+// collected in a fixed buffer and handed either to a registered callback or
+// to a file descriptor. Like stdio, output to a terminal is flushed at
+// every newline; error text always is, so callbacks get whole messages.
+// The put area is left empty so every write, even a single '\n', comes
+// through xsputn() or overflow() where newlines can be seen. A write too
+// big for the buffer goes out together with what is buffered in one
+// writev(), so a TUI frame followed by a flush costs a single system call.
+class SinkBuf : public std::streambuf {
+public:
+    SinkBuf(int fd, bool always_line_buffered)
+        : fd_(fd), always_line_buffered_(always_line_buffered),
+          line_buffered_(always_line_buffered || isatty(fd) == 1) {}
+
+    SinkBuf(const SinkBuf &) = delete;
+    SinkBuf &operator=(const SinkBuf &) = delete;
+
+    void set_callback(nyns_write_fn fn, void *user) {
+        sync();
+        fn_ = fn;
+        user_ = user;
+        line_buffered_ = always_line_buffered_ || (!fn && isatty(fd_) == 1);
+    }
+
+    bool redirected() const { return fn_ != nullptr; }
+
+    // write()/writev() calls, or callback invocations, made so far.
+    std::uint64_t writes() const { return writes_; }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) {
+            return flush_buffer() == 0 ? traits_type::not_eof(ch) : traits_type::eof();
+        }
+        char c = traits_type::to_char_type(ch);
+        return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        auto len = static_cast<std::size_t>(n);
+        if (len > sizeof(buf_) - used_) {
+            std::size_t buffered = used_;
+            used_ = 0;
+            return emit(buf_, buffered, s, len) ? n : 0;
+        }
+        std::memcpy(buf_ + used_, s, len);
+        used_ += len;
+        if (line_buffered_ && std::memchr(s, '\n', len) && flush_buffer() != 0) {
+            return 0;
+        }
+        return n;
+    }
+
+    int sync() override { return flush_buffer(); }
+
+private:
+    int flush_buffer() {
+        std::size_t len = used_;
+        used_ = 0;
+        return (len == 0 || emit(buf_, len, nullptr, 0)) ? 0 : -1;
+    }
+
+    // Writes `a` then `b`, either of which may be empty.
+    bool emit(const char *a, std::size_t a_len, const char *b, std::size_t b_len) {
+        if (fn_) {
+            for (auto [data, len] : {std::pair{a, a_len}, std::pair{b, b_len}}) {
+                if (len > 0) {
+                    ++writes_;
+                    fn_(user_, data, len);
+                }
+            }
+            return true;
+        }
+        iovec iov[2] = {{const_cast<char *>(a), a_len}, {const_cast<char *>(b), b_len}};
+        iovec *first = iov;
+        int count = 2;
+        for (;;) {
+            while (count > 0 && first->iov_len == 0) {
+                ++first;
+                --count;
+            }
+            if (count == 0) {
+                return true;
+            }
+            ++writes_;
+            ssize_t n = writev(fd_, first, count);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            for (auto done = static_cast<std::size_t>(n); done > 0;) {
+                std::size_t step = std::min(done, first->iov_len);
+                first->iov_base = static_cast<char *>(first->iov_base) + step;
+                first->iov_len -= step;
+                done -= step;
+                if (first->iov_len == 0 && done > 0) {
+                    ++first;
+                    --count;
+                }
+            }
+        }
+    }
+
+    int fd_;
+    bool always_line_buffered_;
+    bool line_buffered_;
+    nyns_write_fn fn_ = nullptr;
+    void *user_ = nullptr;
+    std::uint64_t writes_ = 0;
+    std::size_t used_ = 0;
+    char buf_[8192];
+};
+
+// Button labels, stored back to back in one buffer rather than one heap
+// string each, so menus of thousands of entries stay compact.
+class ButtonList {
+public:
+    std::size_t size() const { return spans_.size(); }
+    bool empty() const { return spans_.empty(); }
+
+    std::string_view operator[](std::size_t i) const {
+        return {arena_.data() + spans_[i].first, spans_[i].second};
+    }
+
+    void add(std::string_view label) {
+        spans_.emplace_back(arena_.size(), label.size());
+        arena_.append(label);
+    }
+
+private:
+    std::string arena_;
+    std::vector<std::pair<std::size_t, std::size_t>> spans_;
+};
+
+// Bumped on every SIGWINCH; renderers compare it with the value they last
+// saw to know when to ask the terminal for its size again.
+static std::atomic<unsigned> g_resize_count{0};
+static_assert(std::atomic<unsigned>::is_always_lock_free, "updated from a signal handler");
+
+static void note_resize(int) {
+    g_resize_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Installed only where nobody else handles SIGWINCH; embedders that do can
+// call nyns_terminal_resized() from their own handler instead.
+static void watch_terminal_size() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        struct sigaction old {};
+        if (sigaction(SIGWINCH, nullptr, &old) != 0 || old.sa_handler != SIG_DFL ||
+            (old.sa_flags & SA_SIGINFO) != 0) {
+            return;
+        }
+        struct sigaction sa {};
+        sa.sa_handler = note_resize;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGWINCH, &sa, nullptr);
+    });
+}
+
+// Draws the TUI. Each frame is laid out as rows in a back buffer and
+// compared with the front buffer, which holds what the terminal shows, so
+// only the changed span of each changed row is sent, after a cursor move.
+// Frames are wrapped in synchronized-update escapes and appear at once.
+// Output from anything else (commands, errors, child processes) moves the
+// terminal away from the front buffer; invalidate() then makes the next
+// frame clear the screen and repaint everything, as a frame taller than the
+// terminal always does. Rows are cut to the terminal's width and autowrap is
+// off while a frame is drawn, so each row is exactly one screen line and
+// cursor moves land where the front buffer says. The frame's bytes are
+// built in a buffer that is reused from frame to frame, so the caller can
+// write them in one go.
+// A menu taller than the terminal is shown as a window that scrolls to keep
+// the selected button in view, so a frame costs the same whatever the
+// number of buttons.
+class TuiRenderer {
+public:
+    void invalidate() { front_valid_ = false; }
+
+    std::chrono::steady_clock::time_point last_frame() const { return last_frame_; }
+
+    // Returns the bytes that bring the terminal up to date; they stay valid
+    // until the next draw().
+    const std::string &draw(const std::string &display_text, const ButtonList &buttons,
+                            int selected) {
+        update_terminal_size();
+        std::size_t rows = rows_;
+        layout(display_text, buttons, selected, rows, cols_);
+        frame_.clear();
+        frame_ += "\033[?2026h\033[?7l";
+        if (front_valid_ && back_.size() < rows) {
+            draw_changes();
+        } else {
+            frame_ += "\033[2J\033[H";
+            for (const std::string &row : back_) {
+                frame_ += row;
+                frame_ += '\n';
+            }
+        }
+        frame_ += "\033[?7h\033[?2026l";
+        front_.swap(back_);
+        front_valid_ = front_.size() < rows;
+        last_frame_ = std::chrono::steady_clock::now();
+        return frame_;
+    }
+
+    // Headless output: a line for each change to the display text or the
+    // selected button since the last call, or nothing.
+    const std::string &draw_events(const std::string &display_text, const ButtonList &buttons,
+                                   int selected) {
+        frame_.clear();
+        if (display_text != shown_display_) {
+            shown_display_ = display_text;
+            frame_ += "display: ";
+            if (display_text.empty()) {
+                frame_ += "(no display text)";
+            }
+            for (char c : display_text) {
+                frame_ += c;
+                if (c == '\n') {
+                    frame_ += "         ";
+                }
+            }
+            frame_ += '\n';
+        }
+        bool valid = selected >= 0 && static_cast<std::size_t>(selected) < buttons.size();
+        std::string_view label = valid ? buttons[static_cast<std::size_t>(selected)] : std::string_view();
+        if (selected != shown_selected_ || label != shown_label_) {
+            shown_selected_ = selected;
+            shown_label_ = label;
+            if (valid) {
+                frame_ += "selected: " + std::to_string(selected + 1) + ") [";
+                frame_ += label;
+                frame_ += "]\n";
+            } else {
+                frame_ += "selected: (none)\n";
+            }
+        }
+        return frame_;
+    }
+
+    // 'echo' prints the new display text itself, so headless output need
+    // not report it again.
+    void echoed(const std::string &text) { shown_display_ = text; }
+
+    // The whole TUI as plain text, without escapes.
+    const std::string &draw_plain(const std::string &display_text, const ButtonList &buttons,
+                                  int selected) {
+        layout(display_text, buttons, selected, UNLIMITED, UNLIMITED);
+        frame_.clear();
+        for (const std::string &row : back_) {
+            frame_ += row;
+            frame_ += '\n';
+        }
+        return frame_;
+    }
+
+    // Whether the terminal was resized since the last frame; the screen
+    // then needs repainting.
+    bool resized() const {
+        if (front_.empty()) {
+            return false;
+        }
+        std::uint32_t fixed = fixed_size_.load();
+        return fixed != 0 ? fixed != fixed_seen_ : size_seen_ != g_resize_count.load();
+    }
+
+    // Draws for a terminal of `rows` by `columns` (0: no limit) from now on,
+    // instead of asking standard output for its size: for a terminal that
+    // output reaches through a callback. Safe to call from any thread.
+    void set_size(unsigned rows, unsigned columns) {
+        fixed_size_.store(FIXED_SIZE | std::min(rows, 0x7FFFu) << 16 | std::min(columns, 0xFFFFu));
+    }
+
+    // Whether frames go to standard output, whose size is then asked for
+    // when set_size() has not given one.
+    void set_terminal_output(bool terminal) {
+        terminal_output_ = terminal;
+        size_known_ = false;
+    }
+
+private:
+    static constexpr std::size_t UNLIMITED = static_cast<std::size_t>(-1);
+    static constexpr std::uint32_t FIXED_SIZE = 1u << 31; // Marks fixed_size_ as set
+
+    // Lays the frame out in `rows` screen lines of `columns` characters,
+    // less the line the cursor is parked on, when it would not fit otherwise.
+    // Rows are cut to the width, so each counts as one line; display
+    // text too tall to leave room for the menu is cut short, and the menu
+    // scrolls within what is left.
+    void layout(const std::string &display_text, const ButtonList &buttons, int selected,
+                std::size_t rows, std::size_t columns) {
+        std::size_t count = buttons.size();
+        // Lines the menu needs at the least: the rule under the display
+        // text, the blank line and the menu's header; one button with lines
+        // for those above and below it, or "(no buttons)"; the closing
+        // rule and the cursor's line.
+        std::size_t menu_lines = 3 + (count == 0 ? 1 : std::min<std::size_t>(count, 3)) + 2;
+        std::size_t display_lines =
+            display_text.empty()
+                ? 1
+                : static_cast<std::size_t>(std::count(display_text.begin(), display_text.end(), '\n')) + 1;
+        std::size_t max_display_lines = display_lines;
+        if (rows != UNLIMITED && 1 + display_lines + menu_lines > rows) {
+            max_display_lines = rows > 1 + menu_lines + 1 ? rows - 1 - menu_lines : 1;
+        }
+
+        std::size_t used = 0;
+        auto row = [&]() -> std::string & {
+            if (used == back_.size()) {
+                back_.emplace_back();
+            }
+            std::string &r = back_[used++];
+            r.clear();
+            return r;
+        };
+
+        row() = "==== DISPLAY ====";
+        if (display_text.empty()) {
+            row() = "(no display text)";
+        } else {
+            // With no room for them all, the last line shown counts the rest.
+            std::size_t shown = display_lines > max_display_lines && max_display_lines > 1
+                                    ? max_display_lines - 1
+                                    : std::min(display_lines, max_display_lines);
+            std::size_t start = 0;
+            for (std::size_t line = 0; line < shown; ++line) {
+                std::size_t nl = display_text.find('\n', start);
+                row().assign(display_text, start, nl == std::string::npos ? nl : nl - start);
+                start = nl + 1;
+            }
+            if (shown < display_lines && shown < max_display_lines) {
+                row() = "  ... " + std::to_string(display_lines - shown) + " more lines";
+            }
+        }
+        row() = "=================";
+        row();
+        row() = "==== MENU ====";
+        if (buttons.empty()) {
+            row() = "(no buttons)";
+        }
+        std::size_t first = 0;
+        std::size_t last = count;
+        if (count > 0 && rows != UNLIMITED && used + count + 1 >= rows) {
+            // Room for the buttons, a line for those above and below them,
+            // the closing rule and the cursor's row; at least one button.
+            std::size_t fixed = used + 2 + 1 + 1;
+            std::size_t window = rows > fixed ? rows - fixed : 1;
+            auto current = static_cast<std::size_t>(std::max(selected, 0));
+            if (current < scroll_) {
+                scroll_ = current;
+            } else if (current >= scroll_ + window) {
+                scroll_ = current - window + 1;
+            }
+            scroll_ = std::min(scroll_, count - window);
+            first = scroll_;
+            last = first + window;
+        }
+        if (first > 0) {
+            row() = "  ... " + std::to_string(first) + " more above";
+        }
+        for (std::size_t i = first; i < last; ++i) {
+            std::string &r = row();
+            r += static_cast<int>(i) == selected ? "> " : "  ";
+            r += std::to_string(i + 1);
+            r += ") [";
+            r += buttons[i];
+            r += ']';
+        }
+        if (last < count) {
+            row() = "  ... " + std::to_string(count - last) + " more below";
+        }
+        row() = "==============";
+        back_.resize(used);
+        if (columns != UNLIMITED) {
+            for (std::string &r : back_) {
+                clip(r, columns);
+            }
+        }
+    }
+
+    // Columns count characters, not bytes, so UTF-8 labels stay aligned.
+    static bool is_continuation(char c) { return (static_cast<unsigned char>(c) & 0xC0) == 0x80; }
+
+    // Cuts `row` after `columns` characters, keeping multibyte ones whole.
+    static void clip(std::string &row, std::size_t columns) {
+        std::size_t chars = 0;
+        for (std::size_t i = 0; i < row.size(); ++i) {
+            if (!is_continuation(row[i]) && chars++ == columns) {
+                row.resize(i);
+                return;
+            }
+        }
+    }
+
+    void move_to(std::size_t row, std::size_t column) {
+        char seq[48];
+        int n = std::snprintf(seq, sizeof(seq), "\033[%zu;%zuH", row + 1, column + 1);
+        frame_.append(seq, static_cast<std::size_t>(n));
+    }
+
+    void draw_changes() {
+        for (std::size_t r = 0; r < back_.size(); ++r) {
+            const std::string &now = back_[r];
+            static const std::string none;
+            const std::string &before = r < front_.size() ? front_[r] : none;
+            if (now == before) {
+                continue;
+            }
+            std::size_t start = 0;
+            while (start < now.size() && start < before.size() && now[start] == before[start]) {
+                ++start;
+            }
+            std::size_t end = now.size();
+            if (now.size() == before.size()) {
+                while (end > start && now[end - 1] == before[end - 1]) {
+                    --end;
+                }
+            }
+            while (start > 0 && start < now.size() && is_continuation(now[start])) {
+                --start;
+            }
+            while (end < now.size() && is_continuation(now[end])) {
+                ++end;
+            }
+            std::size_t column = 0;
+            for (std::size_t i = 0; i < start; ++i) {
+                column += is_continuation(now[i]) ? 0 : 1;
+            }
+            move_to(r, column);
+            frame_.append(now, start, end - start);
+            if (now.size() < before.size()) {
+                frame_ += "\033[K";
+            }
+        }
+        if (front_.size() > back_.size()) {
+            move_to(back_.size(), 0);
+            frame_ += "\033[J";
+        }
+        // Leave the cursor where a full repaint would have left it.
+        move_to(back_.size(), 0);
+    }
+
+    // An unknown size (not a terminal) counts as large enough for any frame.
+    // The size is only asked for again after a resize, which also
+    // invalidates what the terminal shows, as it reflows the screen.
+    void update_terminal_size() {
+        std::uint32_t fixed = fixed_size_.load();
+        if (fixed != 0) {
+            if (size_known_ && fixed == fixed_seen_) {
+                return;
+            }
+            if (size_known_) {
+                front_valid_ = false;
+            }
+            fixed_seen_ = fixed;
+            size_known_ = true;
+            std::size_t rows = (fixed & ~FIXED_SIZE) >> 16;
+            std::size_t columns = fixed & 0xFFFF;
+            rows_ = rows > 0 ? rows : UNLIMITED;
+            cols_ = columns > 0 ? columns : UNLIMITED;
+            return;
+        }
+        unsigned seen = g_resize_count.load();
+        if (size_known_ && seen == size_seen_) {
+            return;
+        }
+        if (terminal_output_) {
+            watch_terminal_size();
+        }
+        if (size_known_) {
+            front_valid_ = false;
+        }
+        size_seen_ = seen;
+        size_known_ = true;
+        winsize ws{};
+        bool known = terminal_output_ && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0;
+        rows_ = known && ws.ws_row > 0 ? ws.ws_row : UNLIMITED;
+        cols_ = known && ws.ws_col > 0 ? ws.ws_col : UNLIMITED;
+    }
+
+    std::vector<std::string> front_;
+    std::vector<std::string> back_;
+    std::string frame_;
+    bool front_valid_ = false;
+    std::size_t scroll_ = 0; // First button shown when the menu scrolls
+    std::size_t rows_ = UNLIMITED;
+    std::size_t cols_ = UNLIMITED;
+    unsigned size_seen_ = 0; // g_resize_count when the size was read
+    bool size_known_ = false;
+    bool terminal_output_ = true;
+    std::atomic<std::uint32_t> fixed_size_{0}; // FIXED_SIZE | rows << 16 | columns, from set_size()
+    std::uint32_t fixed_seen_ = 0;              // fixed_size_ when the size was read
+    std::string shown_display_; // As last reported by draw_events()
+    int shown_selected_ = -1;
+    std::string shown_label_;
+    std::chrono::steady_clock::time_point last_frame_;
+};
+
+// Everything a running script can observe or change. Interpreters share
+// nothing mutable but the compiled-script table, which is locked, so several
+// can run on different threads at once. 'moveto' replaces the interpreter's
+// directory fd instead of changing the process working directory, and every
+// relative path a command touches is resolved against that directory.
+class Interpreter {
+public:
+    Interpreter(std::ostream &out_stream, std::ostream &err_stream,
+                std::shared_ptr<ScriptTable> script_table)
+        : out(out_stream), err(err_stream), scripts(std::move(script_table)) {
+        cwd_fd_ = ::open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (cwd_fd_ < 0) {
+            cwd_fd_ = AT_FDCWD;
+        }
+        if (char *cwd = getcwd(nullptr, 0)) {
+            cwd_path_ = cwd;
+            std::free(cwd);
+        } else {
+            cwd_path_ = ".";
+        }
+        resize_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    Interpreter(const Interpreter &) = delete;
+    Interpreter &operator=(const Interpreter &) = delete;
+
+    ~Interpreter() {
+        // Runs normally wait for their jobs; this only avoids leaving
+        // zombies behind after a run that was cut short.
+        for (Job &job : jobs) {
+            if (job.running) {
+                waitpid(job.pid, nullptr, 0);
+            }
+            if (job.pidfd >= 0) {
+                close(job.pidfd);
+            }
+            for (const ChildStream &stream : job.output) {
+                if (stream.fd >= 0) {
+                    close(stream.fd);
+                }
+            }
+        }
+        if (cwd_fd_ >= 0) {
+            close(cwd_fd_);
+        }
+        if (resize_fd >= 0) {
+            close(resize_fd);
+        }
+    }
+
+    // Directory fd for the *at() family of calls.
+    int cwd_fd() const { return cwd_fd_; }
+
+    // Absolute form of `path`, for APIs that only take a path.
+    std::string resolve(std::string_view path) const {
+        if (!path.empty() && path[0] == '/') {
+            return std::string(path);
+        }
+        std::string full = cwd_path_;
+        if (full.empty() || full.back() != '/') {
+            full += '/';
+        }
+        full += path;
+        return full;
+    }
+
+    const std::string &cwd_path() const { return cwd_path_; }
+
+    bool change_directory(const std::string &dir) {
+        int fd = openat(cwd_fd_, dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        std::string path = resolve(dir);
+        if (char *canonical = realpath(path.c_str(), nullptr)) {
+            path = canonical;
+            std::free(canonical);
+        }
+        if (cwd_fd_ >= 0) {
+            close(cwd_fd_);
+        }
+        cwd_fd_ = fd;
+        cwd_path_ = std::move(path);
+        return true;
+    }
+
+    std::ostream &out;
+    std::ostream &err;
+
+    // Simple in-memory representation of a TUI menu consisting of buttons
+    // and a display text area.
+    ButtonList buttons;
+    int selected_button = -1;
+    std::string display_text;
+    TuiRenderer tui;
+    int ui_mode = NYNS_UI_TERMINAL;   // How the TUI is shown, one of NYNS_UI_*
+    int resize_fd = -1; // eventfd, signalled when nyns_set_terminal_size() changes the size
+    bool frame_pending = false;       // The TUI changed since it was last drawn
+    bool final_state_pending = false; // NYNS_UI_FINAL: the run changed the TUI
+
+    std::shared_ptr<ScriptTable> scripts;
+    std::vector<ActiveScript> script_stack; // Outermost first
+
+    std::vector<Job> jobs; // In start order, until reported by 'wait'
+    unsigned next_job_id = 1;
+    // Scratch space for watch_children(), kept to avoid reallocating.
+    std::vector<pollfd> watch_fds;
+    std::vector<std::pair<Job *, ChildStream *>> watch_targets; // No stream: the pidfd
+    std::chrono::steady_clock::time_point next_job_check; // See execute_program()
+    std::vector<AdmUsage> adm_usage; // Since the current run started
+    FrameStats frame_stats;          // Likewise
+
+private:
+    int cwd_fd_ = AT_FDCWD;
+    std::string cwd_path_;
+};
+
+// A frame is written with a single write and flushed straight away, so it
+// reaches the terminal whole whatever the stream's buffering.
+static void write_frame(Interpreter &in, const std::string &frame) {
+    if (frame.empty()) {
+        return;
+    }
+    auto *sink = dynamic_cast<SinkBuf *>(in.out.rdbuf());
+    std::uint64_t writes = sink ? sink->writes() : 0;
+    in.out.write(frame.data(), static_cast<std::streamsize>(frame.size()));
+    in.out.flush();
+    in.frame_stats.frames += 1;
+    in.frame_stats.bytes += frame.size();
+    in.frame_stats.writes += sink ? sink->writes() - writes : 0;
+}
+
+static void draw_tui_menu(Interpreter &in) {
+    switch (in.ui_mode) {
+    case NYNS_UI_EVENTS:
+        write_frame(in, in.tui.draw_events(in.display_text, in.buttons, in.selected_button));
+        break;
+    case NYNS_UI_FINAL:
+        in.final_state_pending = true; // Shown once, when the run ends
+        break;
+    default:
+        write_frame(in, in.tui.draw(in.display_text, in.buttons, in.selected_button));
+        break;
+    }
+}
+
+static std::atomic<bool> g_frame_stats{false};
+
+static void print_frame_stats(const Interpreter &in, std::ostream &os) {
+    const FrameStats &st = in.frame_stats;
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "nyns: %llu frames, %llu bytes in %llu writes (%.1f bytes, %.2f writes per frame)\n",
+                  static_cast<unsigned long long>(st.frames), static_cast<unsigned long long>(st.bytes),
+                  static_cast<unsigned long long>(st.writes),
+                  static_cast<double>(st.bytes) / static_cast<double>(st.frames),
+                  static_cast<double>(st.writes) / static_cast<double>(st.frames));
+    os << line;
+}
+
+static std::atomic<std::int64_t> g_frame_interval_ns{0}; // 0: no frame-rate tick
+
+// UI commands only mark the frame as pending. It is drawn once, before the
+// next command that may write to the terminal, before waiting for input,
+// at the end of a run, or when the frame-rate tick is due, so building a
+// menu of any size costs one frame.
+static void flush_frame(Interpreter &in) {
+    if (in.frame_pending) {
+        in.frame_pending = false;
+        draw_tui_menu(in);
+    }
+}
+
+static void request_frame(Interpreter &in) {
+    in.frame_pending = true;
+    std::int64_t interval = g_frame_interval_ns.load();
+    if (interval > 0 &&
+        std::chrono::steady_clock::now() - in.tui.last_frame() >= std::chrono::nanoseconds(interval)) {
+        flush_frame(in);
+    }
+}
+
+// Error output for a failing UI command, which comes after any pending
+// frame and leaves the terminal out of step with the renderer.
+static std::ostream &ui_error(Interpreter &in) {
+    flush_frame(in);
+    in.tui.invalidate();
+    return in.err;
+}
+
+static void print_ip_addresses(Interpreter &in) {
+    struct ifaddrs *ifaddr = nullptr;
+    if (getifaddrs(&ifaddr) == -1) {
+        report_errno(in.err, "Error getting network interfaces");
+        return;
+    }
+
+    for (struct ifaddrs *ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr) {
+            continue;
+        }
+        int family = ifa->ifa_addr->sa_family;
+        char host[NI_MAXHOST];
+
+        if (family == AF_INET) {
+            auto *addr = reinterpret_cast<sockaddr_in *>(ifa->ifa_addr);
+            if (inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host))) {
+                in.out << ifa->ifa_name << " IPv4 " << host << '\n';
+            }
+        } else if (family == AF_INET6) {
+            auto *addr6 = reinterpret_cast<sockaddr_in6 *>(ifa->ifa_addr);
+            if (inet_ntop(AF_INET6, &addr6->sin6_addr, host, sizeof(host))) {
+                in.out << ifa->ifa_name << " IPv6 " << host << '\n';
+            }
+        }
+    }
+
+    freeifaddrs(ifaddr);
+}
+
+static void print_mbr_partitions(Interpreter &in, const std::string &device) {
+    std::ifstream dev(in.resolve(device), std::ios::binary);
+    if (!dev) {
+        in.err << "Error: cannot open device '" << device << "'\n";
+        return;
+    }
+
+    unsigned char sector[512];
+    dev.read(reinterpret_cast<char *>(sector), sizeof(sector));
+    if (dev.gcount() != static_cast<std::streamsize>(sizeof(sector))) {
+        in.err << "Error: could not read MBR from '" << device << "'\n";
+        return;
+    }
+
+    if (sector[510] != 0x55 || sector[511] != 0xAA) {
+        in.err << "Warning: '" << device << "' does not appear to have a valid MBR signature\n";
+    }
+
+    for (std::size_t i = 0; i < MBR_MAX_PARTITIONS; ++i) {
+        auto *entry = reinterpret_cast<const PartitionEntry *>(
+            sector + MBR_PART_TABLE_OFFSET + i * sizeof(PartitionEntry));
+
+        if (entry->partition_type == 0 || entry->size_sectors == 0) {
+            continue;
+        }
+
+        in.out << "Partition " << (i + 1) << ": "
+                  << "boot=" << (entry->boot_indicator == 0x80 ? "yes" : "no")
+                  << ", type=0x" << std::hex << static_cast<int>(entry->partition_type)
+                  << std::dec
+                  << ", start_lba=" << entry->start_lba
+                  << ", sectors=" << entry->size_sectors
+                  << '\n';
+    }
+}
+
+static bool wipe_mbr_partition_table(Interpreter &in, const std::string &device) {
+    std::string path = in.resolve(device);
+    if (device.rfind("/dev/", 0) == 0 || is_block_device(path)) {
+        in.err << "Refusing to modify real block device '" << device
+                  << "'. Use a disk image file instead.\n";
+        return false;
+    }
+
+    std::fstream dev(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!dev) {
+        in.err << "Error: cannot open device/image '" << device << "' for writing\n";
+        return false;
+    }
+
+    unsigned char sector[512];
+    dev.read(reinterpret_cast<char *>(sector), sizeof(sector));
+    if (dev.gcount() != static_cast<std::streamsize>(sizeof(sector))) {
+        in.err << "Error: could not read MBR from '" << device << "'\n";
+        return false;
+    }
+
+    if (sector[510] != 0x55 || sector[511] != 0xAA) {
+        in.err << "Warning: '" << device
+                  << "' does not have a valid MBR signature; writing anyway\n";
+    }
+
+    std::memset(sector + 446, 0, 64);
+    dev.seekp(0);
+    dev.write(reinterpret_cast<const char *>(sector), sizeof(sector));
+    if (!dev) {
+        in.err << "Error: failed to write updated MBR to '" << device << "'\n";
+        return false;
+    }
+
+    dev.flush();
+    return true;
+}
+
+static bool add_single_partition(Interpreter &in, const std::string &device) {
+    std::string path = in.resolve(device);
+    if (device.rfind("/dev/", 0) == 0 || is_block_device(path)) {
+        in.err << "Refusing to modify real block device '" << device
+                  << "'. Use a disk image file instead.\n";
+        return false;
+    }
+
+    std::fstream dev(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!dev) {
+        in.err << "Error: cannot open device/image '" << device << "' for writing\n";
+        return false;
+    }
+
+    dev.seekg(0, std::ios::end);
+    std::streamoff file_size = dev.tellg();
+    if (file_size <= 0) {
+        in.err << "Error: could not determine size of '" << device << "'\n";
+        return false;
+    }
+    if (file_size < static_cast<std::streamoff>(512 * 2)) {
+        in.err << "Error: image '" << device << "' is too small for a partition table\n";
+        return false;
+    }
+
+    std::uint64_t total_sectors64 = static_cast<std::uint64_t>(file_size / 512);
+    if (total_sectors64 > 0xFFFFFFFFu) {
+        in.err << "Error: image '" << device << "' is too large for 32-bit LBA\n";
+        return false;
+    }
+    std::uint32_t total_sectors = static_cast<std::uint32_t>(total_sectors64);
+
+    dev.seekg(0);
+    unsigned char sector[512];
+    dev.read(reinterpret_cast<char *>(sector), sizeof(sector));
+    if (dev.gcount() != static_cast<std::streamsize>(sizeof(sector))) {
+        in.err << "Error: could not read MBR from '" << device << "'\n";
+        return false;
+    }
+
+    if (sector[510] != 0x55 || sector[511] != 0xAA) {
+        std::memset(sector, 0, sizeof(sector));
+        sector[510] = 0x55;
+        sector[511] = 0xAA;
+    }
+
+    auto *entries = reinterpret_cast<PartitionEntry *>(sector + MBR_PART_TABLE_OFFSET);
+    for (std::size_t i = 0; i < MBR_MAX_PARTITIONS; ++i) {
+        if (entries[i].partition_type != 0 && entries[i].size_sectors != 0) {
+            in.err << "Error: existing partition entries found on '" << device
+                      << "'. Use 'partition " << device << " clean' first.\n";
+            return false;
+        }
+    }
+
+    PartitionEntry &p = entries[0];
+    std::memset(&p, 0, sizeof(p));
+    p.boot_indicator = 0x00;
+    p.partition_type = 0x83; // Linux filesystem
+    p.start_lba = 1;
+    p.size_sectors = total_sectors - 1;
+
+    dev.seekp(0);
+    dev.write(reinterpret_cast<const char *>(sector), sizeof(sector));
+    if (!dev) {
+        in.err << "Error: failed to write updated MBR to '" << device << "'\n";
+        return false;
+    }
+
+    dev.flush();
+    return true;
+}
+
+static bool create_image_with_partition(Interpreter &in, const std::string &image) {
+    std::string path = in.resolve(image);
+    if (image.rfind("/dev/", 0) == 0 || is_block_device(path)) {
+        in.err << "Refusing to create image on real block device path '" << image
+                  << "'. Use a regular file path instead.\n";
+        return false;
+    }
+
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0) {
+        in.err << "Error: image '" << image << "' already exists\n";
+        return false;
+    }
+
+    std::size_t slash_pos = path.rfind('/');
+    if (slash_pos != std::string::npos && slash_pos > 0) {
+        std::string parent = path.substr(0, slash_pos);
+        if (!mkdir_p(parent, in.err)) {
+            return false;
+        }
+    }
+
+    constexpr std::uint32_t sectors = 1024; // 512 KiB image
+    constexpr std::uint64_t image_size = static_cast<std::uint64_t>(sectors) * 512u;
+
+    std::fstream dev(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!dev) {
+        in.err << "Error: cannot create image '" << image << "'\n";
+        return false;
+    }
+
+    unsigned char sector[512];
+    std::memset(sector, 0, sizeof(sector));
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+
+    auto *entries = reinterpret_cast<PartitionEntry *>(sector + MBR_PART_TABLE_OFFSET);
+    std::memset(entries, 0, sizeof(PartitionEntry) * MBR_MAX_PARTITIONS);
+
+    PartitionEntry &p = entries[0];
+    p.boot_indicator = 0x00;
+    p.partition_type = 0x83; // Linux filesystem
+    p.start_lba = 1;
+    p.size_sectors = sectors - 1;
+
+    dev.write(reinterpret_cast<const char *>(sector), sizeof(sector));
+    if (!dev) {
+        in.err << "Error: failed to write MBR to new image '" << image << "'\n";
+        return false;
+    }
+
+    dev.seekp(static_cast<std::streamoff>(image_size) - 1);
+    char zero = 0;
+    dev.write(&zero, 1);
+    if (!dev) {
+        in.err << "Error: failed to resize image '" << image << "'\n";
+        return false;
+    }
+
+    dev.flush();
+    return true;
+}
+
+// Owns a read-only, private mapping of an entire file.
+class FileMapping {
+public:
+    FileMapping() = default;
+    FileMapping(const FileMapping &) = delete;
+    FileMapping &operator=(const FileMapping &) = delete;
+
+    ~FileMapping() {
+        if (addr_) {
+            munmap(addr_, size_);
+        }
+    }
+
+    bool map(int fd, std::size_t size) {
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        addr_ = addr;
+        size_ = size;
+        return true;
+    }
+
+    const char *data() const { return static_cast<const char *>(addr_); }
+    std::size_t size() const { return size_; }
+
+private:
+    void *addr_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// Read-only view of a script's bytes. Regular files are mapped so lines and
+// tokens can be sliced out of the file without copying; pipes, ttys and
+// files that report no size (e.g. under /proc) are read into a buffer.
+class ScriptSource {
+public:
+    ScriptSource() = default;
+    ScriptSource(const ScriptSource &) = delete;
+    ScriptSource &operator=(const ScriptSource &) = delete;
+
+    // Relative paths are resolved against `dirfd`; failures go to `err`.
+    bool open(int dirfd, const std::string &path, std::ostream &err) {
+        int fd = openat(dirfd, path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            err << "Error: cannot open '" << path << "'\n";
+            return false;
+        }
+
+        if (fstat(fd, &st_) == 0 && S_ISREG(st_.st_mode) && st_.st_size > 0 &&
+            mapping_.map(fd, static_cast<std::size_t>(st_.st_size))) {
+            madvise(const_cast<char *>(mapping_.data()), mapping_.size(), MADV_SEQUENTIAL);
+            close(fd);
+            data_ = mapping_.data();
+            size_ = mapping_.size();
+            return true;
+        }
+
+        bool ok = read_all(fd);
+        close(fd);
+        if (!ok) {
+            report_errno(err, "Error reading '" + path + "'");
+            return false;
+        }
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        return true;
+    }
+
+    std::string_view text() const { return std::string_view(data_, size_); }
+
+    // True when the bytes came from a mapped regular file, whose identity
+    // and modification time are then available through stat().
+    bool mapped() const { return mapping_.data() != nullptr; }
+    const struct stat &stat() const { return st_; }
+
+private:
+    bool read_all(int fd) {
+        constexpr std::size_t CHUNK = 64 * 1024;
+        for (;;) {
+            std::size_t used = buffer_.size();
+            buffer_.resize(used + CHUNK);
+            ssize_t n = read(fd, &buffer_[used], CHUNK);
+            if (n < 0 && errno == EINTR) {
+                buffer_.resize(used);
+                continue;
+            }
+            buffer_.resize(used + (n > 0 ? static_cast<std::size_t>(n) : 0));
+            if (n <= 0) {
+                return n == 0;
+            }
+        }
+    }
+
+    FileMapping mapping_;
+    struct stat st_{};
+    const char *data_ = "";
+    std::size_t size_ = 0;
+    std::string buffer_;
+};
+
+// Same character class that operator>> skips in the "C" locale.
+static bool is_token_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Returns the next whitespace-delimited token at or after `pos`, leaving
+// `pos` just past it. An empty view means the line is exhausted.
+static std::string_view next_token(std::string_view line, std::size_t &pos) {
+    while (pos < line.size() && is_token_space(line[pos])) {
+        ++pos;
+    }
+    std::size_t start = pos;
+    while (pos < line.size() && !is_token_space(line[pos])) {
+        ++pos;
+    }
+    return line.substr(start, pos - start);
+}
+
+// Scripts are lowered once into a flat array of instructions. Operands are
+// indices into per-program pools, so executing a line is a single dispatch
+// rather than a re-tokenize followed by a chain of string compares.
+enum class Op : std::uint8_t {
+    Echo,
+    Add,
+    Sub,
+    Rem,
+    Moveto,
+    Help,
+    Ip,
+    Create,
+    Import,
+    Adm,
+    ButtonAdd,
+    ButtonSelect,
+    ButtonNext,
+    ButtonPrev,
+    DisplayChange,
+    PartitionShow,
+    PartitionClean,
+    PartitionAdd,
+    PartitionCreate,
+    Wait,
+    AdmStats,
+    Error, // Diagnostic found while compiling, reported when reached
+};
+
+static constexpr std::uint8_t FLAG_FORCE = 1u << 0;      // rem -f
+static constexpr std::uint8_t FLAG_VALID_INDEX = 1u << 1; // button select
+static constexpr std::uint8_t FLAG_BACKGROUND = 1u << 2;  // adm -bg, -job or '&'
+static constexpr std::uint8_t FLAG_CAPTURE = 1u << 3;     // adm -capture
+static constexpr std::uint8_t FLAG_DEFER = 1u << 4;       // rem -defer
+static constexpr std::uint8_t FLAG_STATS = 1u << 5;       // rem -stats
+
+struct Instruction {
+    Op op;
+    std::uint8_t flags;
+    std::uint32_t a; // string or number pool index, depending on op
+    std::uint32_t b;
+};
+
+// String operands live back to back in `arena`, each followed by a NUL, so
+// they can be handed to C APIs directly through data().
+struct Program {
+    Program() = default;
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+    Program(Program &&) = default;
+    Program &operator=(Program &&) = default;
+
+    std::vector<Instruction> code;
+    std::vector<std::string_view> strings;
+    std::vector<long long> numbers;
+    std::vector<char> arena;
+    std::shared_ptr<const FileMapping> mapping; // Backs `strings` when loaded from the cache
+};
+
+// Builds a Program, interning every string operand so repeated arguments
+// (labels, paths, messages) are stored once.
+class ProgramBuilder {
+public:
+    explicit ProgramBuilder(Program &program) : program_(program) {}
+
+    // `s` must stay valid until finish(); slices of the script source do.
+    std::uint32_t intern(std::string_view s) {
+        auto it = index_.find(s);
+        if (it != index_.end()) {
+            return it->second;
+        }
+        auto idx = static_cast<std::uint32_t>(spans_.size());
+        spans_.emplace_back(program_.arena.size(), s.size());
+        program_.arena.insert(program_.arena.end(), s.begin(), s.end());
+        program_.arena.push_back('\0');
+        index_.emplace(s, idx);
+        return idx;
+    }
+
+    // For text assembled during compilation, which has no home in the source.
+    std::uint32_t intern_owned(std::string s) {
+        auto it = index_.find(s);
+        if (it != index_.end()) {
+            return it->second;
+        }
+        owned_.push_back(std::move(s));
+        return intern(owned_.back());
+    }
+
+    std::uint32_t number(long long value) {
+        auto idx = static_cast<std::uint32_t>(program_.numbers.size());
+        program_.numbers.push_back(value);
+        return idx;
+    }
+
+    void emit(Op op, std::uint32_t a = 0, std::uint32_t b = 0, std::uint8_t flags = 0) {
+        program_.code.push_back(Instruction{op, flags, a, b});
+    }
+
+    void error(std::string message) { emit(Op::Error, intern_owned(std::move(message))); }
+
+    // Points the program's string table into the finished arena.
+    void finish() {
+        program_.strings.clear();
+        program_.strings.reserve(spans_.size());
+        for (const auto &span : spans_) {
+            program_.strings.emplace_back(program_.arena.data() + span.first, span.second);
+        }
+    }
+
+private:
+    Program &program_;
+    std::unordered_map<std::string_view, std::uint32_t> index_;
+    std::vector<std::pair<std::size_t, std::size_t>> spans_;
+    std::deque<std::string> owned_;
+};
+
+// Compile-time perfect hashing for the small, fixed sets of command and
+// sub-command names. A seed is searched for at compile time so that every
+// name lands in its own slot; a lookup is then one hash, one table load and
+// one string compare, whatever the position of the name in its registry.
+constexpr std::uint32_t name_hash(std::string_view name, std::uint32_t seed) {
+    std::uint32_t h = 2166136261u ^ seed;
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    // FNV only carries low bits upward; fold the high bits back down so the
+    // masked slot index depends on the seed.
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    return h;
+}
+
+template <std::size_t Slots>
+struct NameTable {
+    static_assert((Slots & (Slots - 1)) == 0, "slot count must be a power of two");
+
+    std::uint32_t seed = 0;
+    std::array<std::int8_t, Slots> slot{};
+    bool perfect = false;
+
+    // Returns the registry index of `name`, or -1 if it is not registered.
+    template <typename Spec, std::size_t N>
+    int find(const Spec (&specs)[N], std::string_view name) const {
+        int idx = slot[name_hash(name, seed) & (Slots - 1)];
+        return (idx >= 0 && specs[idx].name == name) ? idx : -1;
+    }
+};
+
+template <std::size_t Slots, typename Spec, std::size_t N>
+constexpr NameTable<Slots> make_name_table(const Spec (&specs)[N]) {
+    static_assert(N <= Slots && N <= 127, "too many names for the table");
+    NameTable<Slots> table;
+    for (std::uint32_t seed = 0; seed < 4096; ++seed) {
+        for (auto &s : table.slot) {
+            s = -1;
+        }
+        bool collision = false;
+        for (std::size_t i = 0; i < N && !collision; ++i) {
+            std::uint32_t h = name_hash(specs[i].name, seed) & (Slots - 1);
+            collision = table.slot[h] >= 0;
+            table.slot[h] = static_cast<std::int8_t>(i);
+        }
+        if (!collision) {
+            table.seed = seed;
+            table.perfect = true;
+            return table;
+        }
+    }
+    return table;
+}
+
+struct CommandArgs {
+    std::string_view arg1;
+    std::string_view arg2;
+    std::string_view rest_of_line;
+};
+
+using CompileFn = void (*)(ProgramBuilder &, const CommandArgs &);
+
+struct CommandSpec {
+    std::string_view name;
+    CompileFn compile;
+    const char *help; // Printed verbatim by 'help', in registry order
+};
+
+struct VerbSpec {
+    std::string_view name;
+    CompileFn compile;
+};
+
+static void compile_arith(ProgramBuilder &pb, Op op, const CommandArgs &args) {
+    try {
+        long long a = std::stoll(std::string(args.arg1));
+        long long b = std::stoll(std::string(args.arg2));
+        pb.emit(op, pb.number(a), pb.number(b));
+    } catch (...) {
+        pb.error(op == Op::Add ? "Error: invalid numbers for '+'"
+                               : "Error: invalid numbers for '-'");
+    }
+}
+
+static void compile_echo(ProgramBuilder &pb, const CommandArgs &args) {
+    std::string_view arg1 = args.arg1;
+    std::string_view arg2 = args.arg2;
+    if (arg2.empty()) {
+        pb.emit(Op::Echo, pb.intern(arg1));
+    } else if (arg2.data() == arg1.data() + arg1.size() + 1 && arg1.data()[arg1.size()] == ' ') {
+        // "arg1 arg2" already appears verbatim in the source.
+        pb.emit(Op::Echo,
+                pb.intern(std::string_view(arg1.data(), arg1.size() + 1 + arg2.size())));
+    } else {
+        std::string text(arg1);
+        text += ' ';
+        text += arg2;
+        pb.emit(Op::Echo, pb.intern_owned(std::move(text)));
+    }
+}
+
+static void compile_add(ProgramBuilder &pb, const CommandArgs &args) {
+    compile_arith(pb, Op::Add, args);
+}
+
+static void compile_sub(ProgramBuilder &pb, const CommandArgs &args) {
+    compile_arith(pb, Op::Sub, args);
+}
+
+static void compile_rem(ProgramBuilder &pb, const CommandArgs &args) {
+    // Equivalent to: rm -rf path, with optional -f and -j <workers>
+    std::vector<std::string_view> words = {args.arg1, args.arg2};
+    std::size_t pos = 0;
+    for (std::string_view word = next_token(args.rest_of_line, pos); !word.empty();
+         word = next_token(args.rest_of_line, pos)) {
+        words.push_back(word);
+    }
+
+    std::uint8_t flags = 0;
+    long long jobs = 1;
+    std::size_t i = 0;
+    for (; i < words.size() && !words[i].empty() && words[i][0] == '-'; ++i) {
+        if (words[i] == "-f") {
+            flags |= FLAG_FORCE;
+        } else if (words[i] == "-defer") {
+            flags |= FLAG_DEFER;
+        } else if (words[i] == "-stats") {
+            flags |= FLAG_STATS;
+        } else if (words[i] == "-j") {
+            try {
+                jobs = ++i < words.size() ? std::stoll(std::string(words[i])) : -1;
+            } catch (...) {
+                jobs = -1;
+            }
+            if (jobs < 0) {
+                pb.error("Error: 'rem -j' requires a worker count");
+                return;
+            }
+        } else {
+            break;
+        }
+    }
+    if (i >= words.size() || words[i].empty()) {
+        pb.error(flags & FLAG_FORCE ? "Error: 'rem -f' requires a path"
+                                    : "Error: 'rem' requires a path");
+        return;
+    }
+    pb.emit(Op::Rem, pb.intern(words[i]), pb.number(jobs), flags);
+}
+
+static void compile_moveto(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg1.empty()) {
+        pb.error("Error: 'moveto' requires a directory");
+        return;
+    }
+    pb.emit(Op::Moveto, pb.intern(args.arg1));
+}
+
+static void compile_help(ProgramBuilder &pb, const CommandArgs &) {
+    pb.emit(Op::Help);
+}
+
+static void compile_ip(ProgramBuilder &pb, const CommandArgs &) {
+    pb.emit(Op::Ip);
+}
+
+static void compile_create(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg1.empty()) {
+        pb.error("Error: 'create' requires a filename");
+        return;
+    }
+    pb.emit(Op::Create, pb.intern(args.arg1));
+}
+
+static void compile_import(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg1.empty()) {
+        pb.error("Error: 'import' requires a script path");
+        return;
+    }
+    // Imports are resolved when executed, relative to the directory that
+    // 'moveto' has selected at that point.
+    pb.emit(Op::Import, pb.intern(args.arg1));
+}
+
+// The command's argv is stored as one string with a NUL after every
+// argument, and the argument count in `b`, so running it needs no parsing.
+// A background job's name (empty for a numbered job) is packed in front of
+// its argv. 'adm -sh' becomes /bin/sh -c with the rest of the line verbatim.
+static void compile_adm(ProgramBuilder &pb, const CommandArgs &args) {
+    std::vector<std::string_view> words;
+    for (std::string_view word : {args.arg1, args.arg2}) {
+        if (!word.empty()) {
+            words.push_back(word);
+        }
+    }
+    std::size_t pos = 0;
+    for (std::string_view word = next_token(args.rest_of_line, pos); !word.empty();
+         word = next_token(args.rest_of_line, pos)) {
+        words.push_back(word);
+    }
+
+    bool shell = false;
+    bool capture = false;
+    bool background = false;
+    bool job = false;
+    std::string_view name;
+    std::size_t first = 0;
+    for (; first < words.size(); ++first) {
+        if (words[first] == "-sh") {
+            shell = true;
+        } else if (words[first] == "-capture") {
+            capture = true;
+        } else if (words[first] == "-bg") {
+            background = true;
+        } else if (words[first] == "-job") {
+            if (first + 1 >= words.size()) {
+                pb.error("Error: 'adm -job' requires a name and a command");
+                return;
+            }
+            background = true;
+            job = true;
+            name = words[++first];
+        } else {
+            break;
+        }
+    }
+    if (words.size() == 1 && words[0] == "-stats") {
+        pb.emit(Op::AdmStats);
+        return;
+    }
+    if (first < words.size() && words.back() == "&") {
+        background = true;
+        words.pop_back();
+    }
+    if (first >= words.size()) {
+        pb.error(job ? "Error: 'adm -job' requires a name and a command"
+                     : "Error: 'adm' requires a command");
+        return;
+    }
+    if (capture && background) {
+        pb.error("Error: 'adm -capture' cannot run in the background");
+        return;
+    }
+
+    std::string packed;
+    std::uint32_t count = 0;
+    auto append = [&](std::string_view piece) {
+        if (count++ > 0) {
+            packed += '\0';
+        }
+        packed += piece;
+    };
+    if (background) {
+        append(name);
+    }
+    if (shell) {
+        const char *end = words.back().data() + words.back().size();
+        append("/bin/sh");
+        append("-c");
+        append(std::string_view(words[first].data(), end - words[first].data()));
+    } else {
+        for (std::size_t i = first; i < words.size(); ++i) {
+            append(words[i]);
+        }
+    }
+    pb.emit(Op::Adm, pb.intern_owned(std::move(packed)), count,
+            (background ? FLAG_BACKGROUND : 0) | (capture ? FLAG_CAPTURE : 0));
+}
+
+static void compile_wait(ProgramBuilder &pb, const CommandArgs &args) {
+    // An empty name waits for every job.
+    pb.emit(Op::Wait, pb.intern(args.arg1));
+}
+
+static void compile_button_usage(ProgramBuilder &pb, const CommandArgs &) {
+    pb.error("Error: unknown 'button' usage. Expected one of:\n"
+             "  button add -text <label>\n"
+             "  button select <index>\n"
+             "  button next\n"
+             "  button prev");
+}
+
+static void compile_button_add(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg2 != "-text") {
+        compile_button_usage(pb, args);
+        return;
+    }
+    if (args.rest_of_line.empty()) {
+        pb.error("Error: 'button add -text' requires a label");
+        return;
+    }
+    pb.emit(Op::ButtonAdd, pb.intern(args.rest_of_line));
+}
+
+static void compile_button_select(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg2.empty()) {
+        pb.error("Error: 'button select' requires an index");
+        return;
+    }
+    // The index is parsed now; range checks depend on the buttons that
+    // exist when the instruction runs.
+    try {
+        pb.emit(Op::ButtonSelect, pb.number(std::stoi(std::string(args.arg2))), 0,
+                FLAG_VALID_INDEX);
+    } catch (...) {
+        pb.emit(Op::ButtonSelect);
+    }
+}
+
+static void compile_button_next(ProgramBuilder &pb, const CommandArgs &) {
+    pb.emit(Op::ButtonNext);
+}
+
+static void compile_button_prev(ProgramBuilder &pb, const CommandArgs &) {
+    pb.emit(Op::ButtonPrev);
+}
+
+static constexpr VerbSpec k_button_verbs[] = {
+    {"add", compile_button_add},
+    {"select", compile_button_select},
+    {"next", compile_button_next},
+    {"prev", compile_button_prev},
+};
+
+static constexpr auto k_button_verb_table = make_name_table<8>(k_button_verbs);
+static_assert(k_button_verb_table.perfect, "no perfect hash for button verbs");
+
+static void compile_button(ProgramBuilder &pb, const CommandArgs &args) {
+    int idx = k_button_verb_table.find(k_button_verbs, args.arg1);
+    CompileFn compile = idx >= 0 ? k_button_verbs[idx].compile : compile_button_usage;
+    compile(pb, args);
+}
+
+static void compile_display(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg1 != "-change") {
+        pb.error("Error: unknown 'display' usage. Expected: display -change <text>");
+        return;
+    }
+    std::string_view new_text = !args.rest_of_line.empty() ? args.rest_of_line : args.arg2;
+    if (new_text.empty()) {
+        pb.error("Error: 'display -change' requires text");
+        return;
+    }
+    pb.emit(Op::DisplayChange, pb.intern(new_text));
+}
+
+static void compile_partition_clean(ProgramBuilder &pb, const CommandArgs &args) {
+    pb.emit(Op::PartitionClean, pb.intern(args.arg1));
+}
+
+static void compile_partition_add(ProgramBuilder &pb, const CommandArgs &args) {
+    pb.emit(Op::PartitionAdd, pb.intern(args.arg1));
+}
+
+static void compile_partition_create(ProgramBuilder &pb, const CommandArgs &args) {
+    pb.emit(Op::PartitionCreate, pb.intern(args.arg1));
+}
+
+static constexpr VerbSpec k_partition_verbs[] = {
+    {"wipe", compile_partition_clean},
+    {"clean", compile_partition_clean},
+    {"add", compile_partition_add},
+    {"create", compile_partition_create},
+};
+
+static constexpr auto k_partition_verb_table = make_name_table<8>(k_partition_verbs);
+static_assert(k_partition_verb_table.perfect, "no perfect hash for partition verbs");
+
+static void compile_partition(ProgramBuilder &pb, const CommandArgs &args) {
+    if (args.arg1.empty()) {
+        pb.error("Error: 'partition' requires a device or image path");
+        return;
+    }
+    if (args.arg2.empty()) {
+        pb.emit(Op::PartitionShow, pb.intern(args.arg1));
+        return;
+    }
+    int idx = k_partition_verb_table.find(k_partition_verbs, args.arg2);
+    if (idx < 0) {
+        pb.error("Error: unknown partition action '" + std::string(args.arg2) +
+                 "'. Use no action, 'clean', or 'add'.");
+        return;
+    }
+    k_partition_verbs[idx].compile(pb, args);
+}
+
+// Every command the interpreter understands. Compilation dispatches through
+// this table and 'help' prints it, so the two cannot drift apart.
+static constexpr CommandSpec k_commands[] = {
+    {"echo", compile_echo, "echo: Displays text on-screen\n"},
+    {"+", compile_add, "+: Addition\n"},
+    {"-", compile_sub, "-: Removal of number\n"},
+    {"rem", compile_rem,
+     "rem: Delete a path (irreversible)\n"
+     "rem arguments: -f: Forced deletion\n"
+     "               -j <n>: Delete with n threads (0: one per CPU; at most 4 per CPU)\n"
+     "               -defer: Move the path aside and delete it in the background\n"
+     "               -stats: Report what was deleted, how fast, and any errors\n"},
+    {"moveto", compile_moveto, "moveto: CD into a directory\n"},
+    {"help", compile_help, "help: Get command help\n"},
+    {"ip", compile_ip, "ip: Get IP address information\n"},
+    {"create", compile_create, "create: Create a file\n"},
+    {"import", compile_import, "import: Import a script\n"},
+    {"adm", compile_adm,
+     "adm: Run a command as admin (requires root)\n"
+     "adm arguments: -sh: Run the rest of the line with /bin/sh\n"
+     "               -bg, or a trailing '&': Run in the background\n"
+     "               -job <name>: Run in the background as job <name>\n"
+     "               -capture: Show the command's output as the display text\n"
+     "               -stats: Show the time and resources each command used\n"},
+    {"wait", compile_wait,
+     "wait: Wait for background 'adm' jobs and report how they exited\n"
+     "      wait [<job>]\n"},
+    {"partition", compile_partition,
+     "partition: Show or modify MBR on a disk image\n"
+     "           Usage: partition <image> [clean|add|create]\n"},
+    {"button", compile_button,
+     "button: TUI buttons and selection\n"
+     "        button add -text <label>\n"
+     "        button select <index>\n"
+     "        button next / button prev\n"},
+    {"display", compile_display,
+     "display: Change TUI display text\n"
+     "         display -change <text>\n"},
+};
+
+static constexpr auto k_command_table = make_name_table<32>(k_commands);
+static_assert(k_command_table.perfect, "no perfect hash for command names");
+
+static void compile_line(ProgramBuilder &pb, std::string_view line) {
+    // Mimic: read -r command_type arg1 arg2 <<< "$1"
+    std::size_t pos = 0;
+    std::string_view command_type = next_token(line, pos);
+    if (command_type.empty()) {
+        return;
+    }
+    CommandArgs args;
+    args.arg1 = next_token(line, pos);
+    args.arg2 = next_token(line, pos);
+
+    // Capture the remaining text on the line (if any), typically used for
+    // commands that need more than two arguments, like button labels or
+    // display text. Only leading spaces are trimmed.
+    if (!args.arg2.empty()) {
+        std::string_view rest = line.substr(pos);
+        std::size_t first_non_space = rest.find_first_not_of(' ');
+        if (first_non_space != std::string_view::npos) {
+            args.rest_of_line = rest.substr(first_non_space);
+        }
+    }
+
+    int idx = k_command_table.find(k_commands, command_type);
+    if (idx < 0) {
+        pb.error("Error: Unknown command '" + std::string(command_type) + "'");
+        return;
+    }
+    k_commands[idx].compile(pb, args);
+}
+
+// Splits `text` into lines in place and compiles each one. A single
+// trailing '\r' is dropped, and empty lines and '#' comments are skipped.
+static void compile_text(ProgramBuilder &pb, std::string_view text) {
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        const void *nl = std::memchr(text.data() + pos, '\n', text.size() - pos);
+        std::size_t end = nl ? static_cast<std::size_t>(static_cast<const char *>(nl) - text.data())
+                             : text.size();
+        std::string_view line = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        compile_line(pb, line);
+    }
+}
+
+static bool run_script(Interpreter &in, const std::string &script_path);
+
+using ExecFn = void (*)(Interpreter &, const Instruction &, const Program &);
+
+static void exec_echo(Interpreter &in, const Instruction &ins, const Program &program) {
+    in.display_text = program.strings[ins.a];
+    in.out << in.display_text << '\n';
+    in.tui.echoed(in.display_text);
+    request_frame(in);
+}
+
+static void exec_add(Interpreter &in, const Instruction &ins, const Program &program) {
+    in.out << (program.numbers[ins.a] + program.numbers[ins.b]) << '\n';
+}
+
+static void exec_sub(Interpreter &in, const Instruction &ins, const Program &program) {
+    in.out << (program.numbers[ins.a] - program.numbers[ins.b]) << '\n';
+}
+
+static constexpr unsigned MAX_REM_WORKERS_PER_CPU = 4;
+
+static void exec_rem(Interpreter &in, const Instruction &ins, const Program &program) {
+    bool force = (ins.flags & FLAG_FORCE) != 0;
+    std::string target(program.strings[ins.a]);
+    // Deletion is bound by the filesystem, so workers beyond a few per CPU
+    // only add threads; they are capped rather than spawned by the thousand.
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    long long requested = program.numbers[ins.b];
+    unsigned jobs = requested <= 0 ? cpus
+                                   : static_cast<unsigned>(std::min<long long>(
+                                         requested, cpus * MAX_REM_WORKERS_PER_CPU));
+    bool stats = (ins.flags & FLAG_STATS) != 0;
+    if (ins.flags & FLAG_DEFER) {
+        auto start = std::chrono::steady_clock::now();
+        if (defer_removal(in.cwd_fd(), target, in.err)) {
+            if (stats) {
+                std::chrono::duration<double, std::milli> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                char line[96];
+                std::snprintf(line, sizeof(line), "rem: moved aside in %.3f ms, ", elapsed.count());
+                in.out << line << "deleting '" << target << "' in the background\n";
+            }
+            return;
+        }
+    }
+    TreeRemover remover(jobs, force, in.err);
+    if (stats) {
+        remover.count_bytes();
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool removed = remover.remove(in.cwd_fd(), target, in.resolve(target));
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (stats) {
+        remover.print_stats(in.out, elapsed.count());
+    } else {
+        remover.print_hidden_errors(in.err);
+    }
+    if (!removed && !force) {
+        in.err << "Error removing '" << target << "'\n";
+    }
+}
+
+static void exec_moveto(Interpreter &in, const Instruction &ins, const Program &program) {
+    std::string dir(program.strings[ins.a]);
+    if (!in.change_directory(dir)) {
+        report_errno(in.err, "Error changing directory to '" + dir + "'");
+    }
+}
+
+static void exec_help(Interpreter &in, const Instruction &, const Program &) {
+    for (const CommandSpec &spec : k_commands) {
+        in.out << spec.help;
+    }
+}
+
+static void exec_ip(Interpreter &in, const Instruction &, const Program &) {
+    print_ip_addresses(in);
+}
+
+static void exec_create(Interpreter &in, const Instruction &ins, const Program &program) {
+    std::string_view path = program.strings[ins.a];
+    int fd = openat(in.cwd_fd(), path.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        in.err << "Error creating file '" << path << "'\n";
+        return;
+    }
+    close(fd);
+}
+
+static void exec_import(Interpreter &in, const Instruction &ins, const Program &program) {
+    run_script(in, std::string(program.strings[ins.a]));
+}
+
+// Whether text written to `os` goes to a callback rather than to one of
+// our descriptors, which a child could inherit.
+static bool goes_to_callback(const std::ostream &os) {
+    auto *sink = dynamic_cast<SinkBuf *>(os.rdbuf());
+    return sink && sink->redirected();
+}
+
+static void close_streams(ChildStream (&streams)[2]) {
+    for (ChildStream &stream : streams) {
+        for (int *fd : {&stream.fd, &stream.child_fd}) {
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+}
+
+// Gives the child a pipe for its stdout or stderr wherever what it writes
+// has to pass through us: output is collected into `capture` when that is
+// set, and either stream is relayed when ours goes to a callback, as under
+// --serve. Returns false, having reported why, if a pipe cannot be made.
+static bool open_streams(Interpreter &in, ChildStream (&streams)[2], std::string *capture) {
+    streams[0].capture = capture;
+    streams[0].relay = !capture && goes_to_callback(in.out) ? &in.out : nullptr;
+    streams[1].relay = goes_to_callback(in.err) ? &in.err : nullptr;
+    for (ChildStream &stream : streams) {
+        if (!stream.relay && !stream.capture) {
+            continue;
+        }
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            report_errno(in.err, "Error creating pipe");
+            close_streams(streams);
+            return false;
+        }
+        // Only our end: the child's must block as a terminal or file would.
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        stream.fd = fds[0];
+        stream.child_fd = fds[1];
+    }
+    return true;
+}
+
+// Reads what is available on `stream` and passes it on, closing the pipe
+// once the other end has been closed.
+static void pump_stream(ChildStream &stream) {
+    if (stream.fd < 0) {
+        return;
+    }
+    char buf[64 * 1024];
+    for (;;) {
+        ssize_t n = read(stream.fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (n <= 0) {
+            close(stream.fd);
+            stream.fd = -1;
+            break;
+        }
+        if (stream.capture) {
+            stream.capture->append(buf, static_cast<std::size_t>(n));
+        } else {
+            stream.relay->write(buf, n);
+        }
+    }
+    if (stream.relay) {
+        stream.relay->flush();
+    }
+}
+
+// Passes on what a child writes until it has closed both pipes, for when
+// there is no pidfd to tell when it exits.
+static void follow_streams(ChildStream (&streams)[2]) {
+    for (;;) {
+        pollfd fds[2];
+        nfds_t count = 0;
+        for (const ChildStream &stream : streams) {
+            if (stream.fd >= 0) {
+                fds[count++] = pollfd{stream.fd, POLLIN, 0};
+            }
+        }
+        if (count == 0) {
+            return;
+        }
+        if (poll(fds, count, -1) < 0 && errno != EINTR) {
+            return;
+        }
+        for (ChildStream &stream : streams) {
+            pump_stream(stream);
+        }
+    }
+}
+
+// Takes what is still in the pipes of a child that has exited.
+static void finish_streams(ChildStream (&streams)[2]) {
+    for (ChildStream &stream : streams) {
+        pump_stream(stream);
+    }
+    close_streams(streams);
+}
+
+// Starts argv[0], searched for in PATH, directly in the interpreter's
+// directory (which is not necessarily the process working directory).
+// Its stdout and stderr are the pipes `streams` holds, if any, and ours
+// otherwise; the child's ends are closed here. Returns the child's pid,
+// or -1 with errno set.
+static pid_t spawn_command(Interpreter &in, char *const argv[], ChildStream (&streams)[2]) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in.cwd_fd() != AT_FDCWD) {
+        posix_spawn_file_actions_addfchdir_np(&actions, in.cwd_fd());
+    }
+    for (int target : {STDOUT_FILENO, STDERR_FILENO}) {
+        if (int fd = streams[target - STDOUT_FILENO].child_fd; fd >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, fd, target);
+        }
+    }
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    for (ChildStream &stream : streams) {
+        if (stream.child_fd >= 0) {
+            close(stream.child_fd);
+            stream.child_fd = -1;
+        }
+    }
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+static std::string command_line(char *const argv[]) {
+    std::string line;
+    for (char *const *arg = argv; *arg; ++arg) {
+        if (arg != argv) {
+            line += ' ';
+        }
+        line += *arg;
+    }
+    return line;
+}
+
+static double timeval_ms(const timeval &tv) {
+    return static_cast<double>(tv.tv_sec) * 1000.0 + static_cast<double>(tv.tv_usec) / 1000.0;
+}
+
+// Reaps a child started at `started` and records what it used. Returns its
+// wait status, or -1 if it had already been reaped elsewhere.
+static int reap_child(Interpreter &in, pid_t pid, std::chrono::steady_clock::time_point started,
+                      std::string command_line) {
+    int status = 0;
+    struct rusage usage{};
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - started;
+    in.adm_usage.push_back(AdmUsage{std::move(command_line), wall.count(),
+                                    timeval_ms(usage.ru_utime), timeval_ms(usage.ru_stime),
+                                    usage.ru_maxrss, usage.ru_inblock, usage.ru_oublock});
+    return status;
+}
+
+static void wait_job(Interpreter &in, Job &job) {
+    finish_streams(job.output);
+    job.status = reap_child(in, job.pid, job.started, std::move(job.command_line));
+    if (job.pidfd >= 0) {
+        close(job.pidfd);
+        job.pidfd = -1;
+    }
+    job.running = false;
+}
+
+// Waits up to `timeout_ms` (-1: no limit) for a running job, or for the
+// foreground child behind `fg_pidfd` if there is one, to exit or to write
+// output that has to be passed on. A job is reaped as soon as it is seen to
+// have exited, so its wall time ends there and not when the script next
+// waits. Returns true once the foreground child has exited; it is left for
+// the caller to reap.
+//
+// Children are watched through pidfds rather than SIGCHLD or waitpid(-1),
+// so an interpreter never reaps children that belong to another interpreter
+// or to the host program. Jobs without a pidfd (kernels before 5.3) cannot
+// be watched; an unlimited wait for jobs alone then waits for the oldest.
+static bool watch_children(Interpreter &in, int timeout_ms, int fg_pidfd = -1,
+                           ChildStream *fg_streams = nullptr) {
+    std::vector<pollfd> &fds = in.watch_fds;
+    std::vector<std::pair<Job *, ChildStream *>> &watched = in.watch_targets;
+    fds.clear();
+    watched.clear();
+    auto watch = [&](int pidfd, Job *job, ChildStream *streams) {
+        fds.push_back(pollfd{pidfd, POLLIN, 0});
+        watched.emplace_back(job, nullptr);
+        for (int i = 0; streams && i < 2; ++i) {
+            if (streams[i].fd >= 0) {
+                fds.push_back(pollfd{streams[i].fd, POLLIN, 0});
+                watched.emplace_back(job, &streams[i]);
+            }
+        }
+    };
+    if (fg_pidfd >= 0) {
+        watch(fg_pidfd, nullptr, fg_streams);
+    }
+    for (Job &job : in.jobs) {
+        if (!job.running) {
+            continue;
+        }
+        if (job.pidfd >= 0) {
+            watch(job.pidfd, &job, job.output);
+        } else if (fg_pidfd < 0 && timeout_ms < 0) {
+            follow_streams(job.output);
+            wait_job(in, job);
+            return false;
+        }
+    }
+    if (fds.empty()) {
+        return false;
+    }
+    int ready;
+    while ((ready = poll(fds.data(), fds.size(), timeout_ms)) < 0) {
+        if (errno != EINTR) {
+            // Fall back to a blocking wait for whichever child comes first.
+            if (watched[0].first) {
+                wait_job(in, *watched[0].first);
+            }
+            return !watched[0].first;
+        }
+    }
+    bool fg_exited = false;
+    for (std::size_t i = 0; ready > 0 && i < fds.size(); ++i) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        auto [job, stream] = watched[i];
+        if (stream) {
+            pump_stream(*stream);
+        } else if (job) {
+            wait_job(in, *job);
+        } else {
+            fg_exited = true;
+        }
+    }
+    return fg_exited;
+}
+
+// Waits for a foreground child started by spawn_command() to exit, passing
+// on its output and reaping any job that exits meanwhile. The child itself
+// is left for reap_child().
+static void follow_child(Interpreter &in, pid_t pid, ChildStream (&streams)[2]) {
+    bool watching = streams[0].fd >= 0 || streams[1].fd >= 0 ||
+                    std::any_of(in.jobs.begin(), in.jobs.end(),
+                                [](const Job &job) { return job.running; });
+    int pidfd = watching ? static_cast<int>(syscall(SYS_pidfd_open, pid, 0)) : -1;
+    if (pidfd >= 0) {
+        while (!watch_children(in, -1, pidfd, streams)) {
+        }
+        close(pidfd);
+    } else {
+        follow_streams(streams);
+    }
+    finish_streams(streams);
+}
+
+static std::size_t running_jobs(const Interpreter &in) {
+    return static_cast<std::size_t>(
+        std::count_if(in.jobs.begin(), in.jobs.end(), [](const Job &job) { return job.running; }));
+}
+
+// 'adm' jobs mostly wait on I/O or on other processes rather than use a
+// CPU each, so the default does not follow the number of CPUs.
+static constexpr unsigned DEFAULT_JOB_LIMIT = 16;
+
+static std::atomic<unsigned> g_job_limit{0}; // 0: DEFAULT_JOB_LIMIT
+
+static void start_job(Interpreter &in, std::string name, char *const argv[]) {
+    unsigned limit = g_job_limit.load();
+    if (limit == 0) {
+        limit = DEFAULT_JOB_LIMIT;
+    }
+    while (running_jobs(in) >= limit) {
+        watch_children(in, -1);
+    }
+
+    std::string number = std::to_string(in.next_job_id++);
+    Job job;
+    if (!open_streams(in, job.output, nullptr)) {
+        return;
+    }
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = spawn_command(in, argv, job.output);
+    if (pid < 0) {
+        report_errno(in.err, "Error running admin command '" + std::string(argv[0]) + "'");
+        close_streams(job.output);
+        return;
+    }
+    job.name = name.empty() ? std::move(number) : std::move(name);
+    job.command = argv[0];
+    job.command_line = command_line(argv);
+    job.pid = pid;
+    job.started = started;
+    job.pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    in.jobs.push_back(std::move(job));
+}
+
+static void report_job(Interpreter &in, const Job &job) {
+    in.out << "Job '" << job.name << "' (" << job.command << ") ";
+    if (job.status == -1) {
+        in.out << "finished with unknown status\n";
+    } else if (WIFSIGNALED(job.status)) {
+        in.out << "was killed by signal " << WTERMSIG(job.status) << '\n';
+    } else {
+        in.out << "exited with status " << WEXITSTATUS(job.status) << '\n';
+    }
+}
+
+// Waits for the jobs called `name`, or for all jobs when it is empty, and
+// reports each of them once, in the order they were started.
+static void wait_for_jobs(Interpreter &in, std::string_view name) {
+    auto matches = [&](const Job &job) { return name.empty() || job.name == name; };
+    if (!name.empty() && std::none_of(in.jobs.begin(), in.jobs.end(), matches)) {
+        in.err << "Error: no background job named '" << name << "'\n";
+        return;
+    }
+    while (std::any_of(in.jobs.begin(), in.jobs.end(),
+                       [&](const Job &job) { return job.running && matches(job); })) {
+        watch_children(in, -1);
+    }
+    for (auto it = in.jobs.begin(); it != in.jobs.end();) {
+        if (matches(*it)) {
+            report_job(in, *it);
+            it = in.jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Runs a command with its standard output on a pipe and makes everything it
+// wrote the display text, with the menu drawn once at the end rather than
+// per chunk. The output is appended in 64 KiB reads to a string that grows
+// geometrically, so large outputs cost a logarithmic number of
+// reallocations and no temporary file. As with $(...) in the shell,
+// trailing newlines are dropped.
+static void capture_command(Interpreter &in, char *const argv[]) {
+    std::string output;
+    ChildStream streams[2];
+    if (!open_streams(in, streams, &output)) {
+        return;
+    }
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = spawn_command(in, argv, streams);
+    if (pid < 0) {
+        report_errno(in.err, "Error running admin command '" + std::string(argv[0]) + "'");
+        close_streams(streams);
+        return;
+    }
+    follow_child(in, pid, streams);
+    reap_child(in, pid, started, command_line(argv));
+
+    while (!output.empty() && output.back() == '\n') {
+        output.pop_back();
+    }
+    in.display_text = std::move(output);
+    request_frame(in);
+}
+
+static void exec_adm(Interpreter &in, const Instruction &ins, const Program &program) {
+    if (geteuid() != 0) {
+        in.err << "Error: 'adm' requires root privileges (run nyns as root)\n";
+        return;
+    }
+    // Every piece is NUL-terminated inside the string pool.
+    std::vector<char *> argv;
+    const char *arg = program.strings[ins.a].data();
+    for (std::uint32_t i = 0; i < ins.b; ++i) {
+        argv.push_back(const_cast<char *>(arg));
+        arg += std::strlen(arg) + 1;
+    }
+    argv.push_back(nullptr);
+
+    // The child writes to the inherited descriptors or to pipes we relay,
+    // either way after our own pending output.
+    in.out.flush();
+    if (ins.flags & FLAG_BACKGROUND) {
+        start_job(in, argv[0], argv.data() + 1);
+        return;
+    }
+    if (ins.flags & FLAG_CAPTURE) {
+        capture_command(in, argv.data());
+        return;
+    }
+
+    ChildStream streams[2];
+    if (!open_streams(in, streams, nullptr)) {
+        return;
+    }
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = spawn_command(in, argv.data(), streams);
+    if (pid < 0) {
+        report_errno(in.err, "Error running admin command '" + std::string(argv[0]) + "'");
+        close_streams(streams);
+        return;
+    }
+    follow_child(in, pid, streams);
+    reap_child(in, pid, started, command_line(argv.data()));
+}
+
+// One line per finished command, slowest first.
+static void print_adm_usage(const Interpreter &in, std::ostream &os) {
+    std::vector<const AdmUsage *> sorted;
+    sorted.reserve(in.adm_usage.size());
+    for (const AdmUsage &usage : in.adm_usage) {
+        sorted.push_back(&usage);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const AdmUsage *a, const AdmUsage *b) {
+        return a->wall_ms > b->wall_ms;
+    });
+
+    os << "nyns: adm usage, slowest first\n";
+    os << "     wall ms     user ms      sys ms  max RSS KiB   blk in  blk out  command\n";
+    for (const AdmUsage *usage : sorted) {
+        char line[96];
+        std::snprintf(line, sizeof(line), "  %10.3f  %10.3f  %10.3f  %11ld  %7ld  %7ld  ",
+                      usage->wall_ms, usage->user_ms, usage->sys_ms, usage->max_rss_kib,
+                      usage->blocks_in, usage->blocks_out);
+        os << line << usage->command_line << '\n';
+    }
+}
+
+static void exec_adm_stats(Interpreter &in, const Instruction &, const Program &) {
+    print_adm_usage(in, in.out);
+}
+
+static void exec_wait(Interpreter &in, const Instruction &ins, const Program &program) {
+    wait_for_jobs(in, program.strings[ins.a]);
+}
+
+static void exec_button_add(Interpreter &in, const Instruction &ins, const Program &program) {
+    in.buttons.add(program.strings[ins.a]);
+    if (in.selected_button < 0) {
+        in.selected_button = 0;
+    }
+    request_frame(in);
+}
+
+static void exec_button_select(Interpreter &in, const Instruction &ins, const Program &program) {
+    if (in.buttons.empty()) {
+        ui_error(in) << "Error: no buttons to select\n";
+        return;
+    }
+    if ((ins.flags & FLAG_VALID_INDEX) == 0) {
+        ui_error(in) << "Error: invalid index for 'button select'\n";
+        return;
+    }
+    long long idx = program.numbers[ins.a];
+    if (idx < 1 || idx > static_cast<long long>(in.buttons.size())) {
+        ui_error(in) << "Error: button index out of range\n";
+        return;
+    }
+    in.selected_button = static_cast<int>(idx - 1);
+    request_frame(in);
+}
+
+static void exec_button_step(Interpreter &in, int delta) {
+    if (in.buttons.empty()) {
+        ui_error(in) << "Error: no buttons to navigate\n";
+        return;
+    }
+    int count = static_cast<int>(in.buttons.size());
+    if (in.selected_button < 0 || in.selected_button >= count) {
+        in.selected_button = 0;
+    } else {
+        in.selected_button = (in.selected_button + delta + count) % count;
+    }
+    request_frame(in);
+}
+
+static void exec_button_next(Interpreter &in, const Instruction &, const Program &) {
+    exec_button_step(in, 1);
+}
+
+static void exec_button_prev(Interpreter &in, const Instruction &, const Program &) {
+    exec_button_step(in, -1);
+}
+
+static void exec_display_change(Interpreter &in, const Instruction &ins, const Program &program) {
+    in.display_text = program.strings[ins.a];
+    request_frame(in);
+}
+
+static void exec_partition_show(Interpreter &in, const Instruction &ins, const Program &program) {
+    print_mbr_partitions(in, std::string(program.strings[ins.a]));
+}
+
+static void exec_partition_clean(Interpreter &in, const Instruction &ins, const Program &program) {
+    std::string device(program.strings[ins.a]);
+    if (wipe_mbr_partition_table(in, device)) {
+        in.out << "MBR partition table cleaned on '" << device << "'\n";
+    }
+}
+
+static void exec_partition_add(Interpreter &in, const Instruction &ins, const Program &program) {
+    std::string device(program.strings[ins.a]);
+    if (add_single_partition(in, device)) {
+        in.out << "Single primary partition added on '" << device << "'\n";
+    }
+}
+
+static void exec_partition_create(Interpreter &in, const Instruction &ins, const Program &program) {
+    std::string image(program.strings[ins.a]);
+    if (create_image_with_partition(in, image)) {
+        in.out << "Disk image created with single primary partition at '" << image << "'\n";
+    }
+}
+
+static void exec_error(Interpreter &in, const Instruction &ins, const Program &program) {
+    in.err << program.strings[ins.a] << '\n';
+}
+
+// The pool an instruction operand indexes, if any.
+enum class Operand : std::uint8_t {
+    None,
+    String,
+    Number,
+};
+
+struct OpSpec {
+    Op op;
+    ExecFn exec;
+    bool ui = false; // Writes nothing but TUI frames, on success
+    Operand a = Operand::None;
+    Operand b = Operand::None;
+};
+
+static constexpr OpSpec k_op_specs[] = {
+    {Op::Echo, exec_echo, false, Operand::String},
+    {Op::Add, exec_add, false, Operand::Number, Operand::Number},
+    {Op::Sub, exec_sub, false, Operand::Number, Operand::Number},
+    {Op::Rem, exec_rem, false, Operand::String, Operand::Number},
+    {Op::Moveto, exec_moveto, false, Operand::String},
+    {Op::Help, exec_help},
+    {Op::Ip, exec_ip},
+    {Op::Create, exec_create, false, Operand::String},
+    {Op::Import, exec_import, false, Operand::String},
+    {Op::Adm, exec_adm, false, Operand::String}, // `b` is the argument count
+    {Op::ButtonAdd, exec_button_add, true, Operand::String},
+    {Op::ButtonSelect, exec_button_select, true, Operand::Number}, // With FLAG_VALID_INDEX
+    {Op::ButtonNext, exec_button_next, true},
+    {Op::ButtonPrev, exec_button_prev, true},
+    {Op::DisplayChange, exec_display_change, true, Operand::String},
+    {Op::PartitionShow, exec_partition_show, false, Operand::String},
+    {Op::PartitionClean, exec_partition_clean, false, Operand::String},
+    {Op::PartitionAdd, exec_partition_add, false, Operand::String},
+    {Op::PartitionCreate, exec_partition_create, false, Operand::String},
+    {Op::Wait, exec_wait, false, Operand::String},
+    {Op::AdmStats, exec_adm_stats},
+    {Op::Error, exec_error, false, Operand::String},
+};
+
+static constexpr std::size_t OP_COUNT = static_cast<std::size_t>(Op::Error) + 1;
+
+// Handler table indexed by opcode, built from k_op_specs so the order of
+// that list does not matter.
+static constexpr std::array<ExecFn, OP_COUNT> make_exec_table() {
+    std::array<ExecFn, OP_COUNT> table{};
+    for (const OpSpec &spec : k_op_specs) {
+        table[static_cast<std::size_t>(spec.op)] = spec.exec;
+    }
+    return table;
+}
+
+static constexpr std::array<ExecFn, OP_COUNT> k_exec_table = make_exec_table();
+
+static constexpr bool exec_table_complete() {
+    for (ExecFn fn : k_exec_table) {
+        if (fn == nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(exec_table_complete(), "every opcode needs a handler");
+
+static constexpr std::array<bool, OP_COUNT> make_ui_table() {
+    std::array<bool, OP_COUNT> table{};
+    for (const OpSpec &spec : k_op_specs) {
+        table[static_cast<std::size_t>(spec.op)] = spec.ui;
+    }
+    return table;
+}
+
+static constexpr std::array<bool, OP_COUNT> k_ui_table = make_ui_table();
+
+static constexpr std::array<std::array<Operand, 2>, OP_COUNT> make_operand_table() {
+    std::array<std::array<Operand, 2>, OP_COUNT> table{};
+    for (const OpSpec &spec : k_op_specs) {
+        table[static_cast<std::size_t>(spec.op)] = {spec.a, spec.b};
+    }
+    return table;
+}
+
+static constexpr std::array<std::array<Operand, 2>, OP_COUNT> k_operand_table = make_operand_table();
+
+// Optional persistent cache of compiled programs, one file per script named
+// after a hash of its canonical path. An entry is reused without reading the
+// script at all when the script's size, mtime and inode still match, and is
+// re-stamped instead of recompiled when only the mtime moved but the content
+// hash is unchanged. Imports are compiled lazily when they execute, so every
+// imported script goes through this same check against its own entry and an
+// edited import never hides behind its importer's cache entry.
+static std::string g_cache_dir; // Empty when the cache is disabled
+
+static constexpr char CACHE_MAGIC[8] = {'N', 'Y', 'N', 'S', 'C', '\0', '\0', '\0'};
+// Bumped whenever the same script may compile to different instructions:
+// new or renumbered opcodes, flags, or a change in how arguments parse.
+static constexpr std::uint32_t CACHE_VERSION = 6;
+
+struct CacheHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t instruction_size;
+    std::uint64_t source_size;
+    std::int64_t source_mtime_ns;
+    std::uint64_t source_ino;
+    std::uint64_t content_hash;
+    std::uint64_t number_count;
+    std::uint64_t code_count;
+    std::uint64_t string_count;
+    std::uint64_t arena_size;
+};
+
+// Layout after the header, each section naturally aligned:
+//   long long numbers[number_count]
+//   Instruction code[code_count]
+//   std::uint32_t spans[string_count][2]   (arena offset, length)
+//   char arena[arena_size]                 (NUL after every string)
+
+static std::string default_cache_dir() {
+    if (const char *dir = std::getenv("NYNS_CACHE_DIR"); dir && *dir) {
+        return dir;
+    }
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        return std::string(xdg) + "/nyns";
+    }
+    if (const char *home = std::getenv("HOME"); home && *home) {
+        return std::string(home) + "/.cache/nyns";
+    }
+    return std::string();
+}
+
+static std::uint64_t content_hash(std::string_view bytes) {
+    std::uint64_t h = 14695981039346656037ull;
+    for (char c : bytes) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::int64_t mtime_ns(const struct stat &st) {
+    return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static std::string cache_entry_path(const std::string &script_path) {
+    char *canonical = realpath(script_path.c_str(), nullptr);
+    if (!canonical) {
+        return std::string();
+    }
+    std::uint64_t key = content_hash(canonical);
+    std::free(canonical);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.nynsc", static_cast<unsigned long long>(key));
+    return g_cache_dir + name;
+}
+
+static bool stamp_matches(const CacheHeader &hdr, const struct stat &st) {
+    return hdr.source_size == static_cast<std::uint64_t>(st.st_size) &&
+           hdr.source_mtime_ns == mtime_ns(st) &&
+           hdr.source_ino == static_cast<std::uint64_t>(st.st_ino);
+}
+
+// Maps a cache entry and, if it is well formed, points `program` into it.
+// Fills `hdr` whenever a header could be read, even if the body is unusable.
+static bool load_cache_entry(const std::string &path, CacheHeader &hdr, Program &program) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st{};
+    auto mapping = std::make_shared<FileMapping>();
+    bool mapped = fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(hdr) &&
+                  mapping->map(fd, static_cast<std::size_t>(st.st_size));
+    close(fd);
+    if (!mapped) {
+        return false;
+    }
+
+    std::memcpy(&hdr, mapping->data(), sizeof(hdr));
+    if (std::memcmp(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        hdr.version != CACHE_VERSION || hdr.instruction_size != sizeof(Instruction)) {
+        return false;
+    }
+
+    const std::uint64_t limit = mapping->size();
+    std::uint64_t off = sizeof(hdr);
+    auto section = [&](std::uint64_t count, std::uint64_t elem) -> const char * {
+        if (count > limit / elem || count * elem > limit - off) {
+            return nullptr;
+        }
+        const char *p = mapping->data() + off;
+        off += count * elem;
+        return p;
+    };
+    const char *numbers = section(hdr.number_count, sizeof(long long));
+    const char *code = numbers ? section(hdr.code_count, sizeof(Instruction)) : nullptr;
+    const char *spans = code ? section(hdr.string_count, 2 * sizeof(std::uint32_t)) : nullptr;
+    const char *arena = spans ? section(hdr.arena_size, 1) : nullptr;
+    if (!arena) {
+        return false;
+    }
+
+    Program loaded;
+    loaded.numbers.resize(hdr.number_count);
+    std::memcpy(loaded.numbers.data(), numbers, hdr.number_count * sizeof(long long));
+    loaded.code.resize(hdr.code_count);
+    std::memcpy(loaded.code.data(), code, hdr.code_count * sizeof(Instruction));
+    loaded.strings.reserve(hdr.string_count);
+    for (std::uint64_t i = 0; i < hdr.string_count; ++i) {
+        std::uint32_t span[2];
+        std::memcpy(span, spans + i * sizeof(span), sizeof(span));
+        if (span[0] > hdr.arena_size || span[1] >= hdr.arena_size - span[0] ||
+            arena[span[0] + span[1]] != '\0') {
+            return false;
+        }
+        loaded.strings.emplace_back(arena + span[0], span[1]);
+    }
+    // Every operand must lie inside the pool its opcode reads it from.
+    auto in_pool = [&](Operand kind, std::uint32_t idx) {
+        switch (kind) {
+        case Operand::String:
+            return idx < hdr.string_count;
+        case Operand::Number:
+            return idx < hdr.number_count;
+        default:
+            return true;
+        }
+    };
+    for (const Instruction &ins : loaded.code) {
+        auto op = static_cast<std::size_t>(ins.op);
+        if (op >= OP_COUNT) {
+            return false;
+        }
+        const auto &operands = k_operand_table[op];
+        bool checked_a = ins.op != Op::ButtonSelect || (ins.flags & FLAG_VALID_INDEX) != 0;
+        if ((checked_a && !in_pool(operands[0], ins.a)) || !in_pool(operands[1], ins.b)) {
+            return false;
+        }
+        // `b` counts the NUL-separated pieces packed into string `a`.
+        if (ins.op == Op::Adm &&
+            ins.b != 1 + std::count(loaded.strings[ins.a].begin(), loaded.strings[ins.a].end(),
+                                    '\0')) {
+            return false;
+        }
+    }
+
+    loaded.mapping = std::move(mapping);
+    program = std::move(loaded);
+    return true;
+}
+
+// Writes the entry to a temporary name and renames it into place, so
+// concurrent runs never observe a partial file. Failures only cost the
+// next run a recompile, so apart from the cache directory itself they are
+// not reported.
+static void store_cache_entry(const std::string &path, CacheHeader hdr, const Program &program,
+                              std::ostream &err) {
+    if (!mkdir_p(g_cache_dir, err)) {
+        return;
+    }
+
+    std::vector<std::uint32_t> spans;
+    spans.reserve(program.strings.size() * 2);
+    for (std::string_view s : program.strings) {
+        spans.push_back(static_cast<std::uint32_t>(s.data() - program.arena.data()));
+        spans.push_back(static_cast<std::uint32_t>(s.size()));
+    }
+
+    std::memcpy(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    hdr.version = CACHE_VERSION;
+    hdr.instruction_size = sizeof(Instruction);
+    hdr.number_count = program.numbers.size();
+    hdr.code_count = program.code.size();
+    hdr.string_count = program.strings.size();
+    hdr.arena_size = program.arena.size();
+
+    static std::atomic<unsigned> tmp_serial{0};
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + '.' + std::to_string(tmp_serial++);
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    out.write(reinterpret_cast<const char *>(program.numbers.data()),
+              static_cast<std::streamsize>(program.numbers.size() * sizeof(long long)));
+    out.write(reinterpret_cast<const char *>(program.code.data()),
+              static_cast<std::streamsize>(program.code.size() * sizeof(Instruction)));
+    out.write(reinterpret_cast<const char *>(spans.data()),
+              static_cast<std::streamsize>(spans.size() * sizeof(std::uint32_t)));
+    out.write(program.arena.data(), static_cast<std::streamsize>(program.arena.size()));
+    out.close();
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+}
+
+static void restamp_cache_entry(const std::string &path, CacheHeader hdr, const struct stat &st) {
+    hdr.source_mtime_ns = mtime_ns(st);
+    hdr.source_ino = static_cast<std::uint64_t>(st.st_ino);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (pwrite(fd, &hdr, sizeof(hdr), 0) != static_cast<ssize_t>(sizeof(hdr))) {
+            std::remove(path.c_str());
+        }
+        close(fd);
+    }
+}
+
+static bool compile_script(Interpreter &in, const std::string &script_path, Program &program) {
+    ScriptSource source;
+    if (!source.open(in.cwd_fd(), script_path, in.err)) {
+        return false;
+    }
+
+    std::string entry;
+    if (!g_cache_dir.empty() && source.mapped()) {
+        entry = cache_entry_path(in.resolve(script_path));
+    }
+
+    CacheHeader hdr{};
+    std::uint64_t hash = 0;
+    if (!entry.empty()) {
+        bool loaded = load_cache_entry(entry, hdr, program);
+        if (loaded && stamp_matches(hdr, source.stat())) {
+            return true;
+        }
+        hash = content_hash(source.text());
+        if (loaded && hdr.content_hash == hash &&
+            hdr.source_size == static_cast<std::uint64_t>(source.stat().st_size)) {
+            restamp_cache_entry(entry, hdr, source.stat());
+            return true;
+        }
+        program = Program();
+    }
+
+    ProgramBuilder pb(program);
+    compile_text(pb, source.text());
+    pb.finish();
+
+    if (!entry.empty()) {
+        CacheHeader fresh{};
+        fresh.source_size = static_cast<std::uint64_t>(source.stat().st_size);
+        fresh.source_mtime_ns = mtime_ns(source.stat());
+        fresh.source_ino = static_cast<std::uint64_t>(source.stat().st_ino);
+        fresh.content_hash = hash;
+        store_cache_entry(entry, fresh, program, in.err);
+    }
+    return true;
+}
+
+// How often execute_program() looks for jobs that have exited.
+static constexpr auto JOB_CHECK_INTERVAL = std::chrono::milliseconds(1);
+
+static void execute_program(Interpreter &in, const Program &program) {
+    for (const Instruction &ins : program.code) {
+        // Reap jobs that have exited, and pass on what they wrote, without
+        // waiting: a job's wall time should not include the commands after it.
+        // A poll per instruction would dominate a tight script, so this runs
+        // at most once per JOB_CHECK_INTERVAL; a job's wall time may be that
+        // much late.
+        if (!in.jobs.empty()) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= in.next_job_check) {
+                watch_children(in, 0);
+                in.next_job_check = now + JOB_CHECK_INTERVAL;
+            }
+        }
+        auto op = static_cast<std::size_t>(ins.op);
+        // Anything else may write to the terminal behind the renderer's back.
+        if (!k_ui_table[op]) {
+            flush_frame(in);
+            in.tui.invalidate();
+        }
+        k_exec_table[op](in, ins, program);
+    }
+}
+
+// Scripts already compiled in this process, keyed by device and inode and
+// revalidated by size and mtime, so a helper imported inside a loop is read
+// and compiled once. Interpreters running on other threads share the table.
+// A resident process (--serve) keeps the table for its whole life, so an
+// entry is dropped when its path is found to name a new file (an editor's
+// atomic save), and the least recently used one when the table is full.
+// Interpreters still running a dropped program keep it alive themselves.
+struct LoadedScript {
+    std::string canonical_path;
+    std::uint64_t size;
+    std::int64_t mtime_ns;
+    std::shared_ptr<const Program> program;
+    std::uint64_t last_used; // ScriptTable::clock when last run
+};
+
+struct ScriptTable {
+    static constexpr std::size_t MAX_SCRIPTS = 1024;
+
+    std::mutex mutex;
+    std::unordered_map<FileId, LoadedScript, FileIdHash> loaded;
+    std::unordered_map<std::string, FileId> by_path; // Canonical path to its entry
+    std::uint64_t clock = 0;
+
+    void erase(std::unordered_map<FileId, LoadedScript, FileIdHash>::iterator it) {
+        auto path = by_path.find(it->second.canonical_path);
+        if (path != by_path.end() && path->second == it->first) {
+            by_path.erase(path);
+        }
+        loaded.erase(it);
+    }
+
+    void insert(const FileId &id, LoadedScript script) {
+        if (auto old = by_path.find(script.canonical_path);
+            old != by_path.end() && !(old->second == id)) {
+            if (auto stale = loaded.find(old->second); stale != loaded.end()) {
+                erase(stale);
+            }
+        }
+        if (auto existing = loaded.find(id); existing != loaded.end()) {
+            erase(existing);
+        }
+        if (loaded.size() >= MAX_SCRIPTS) {
+            erase(std::min_element(loaded.begin(), loaded.end(), [](const auto &a, const auto &b) {
+                return a.second.last_used < b.second.last_used;
+            }));
+        }
+        script.last_used = ++clock;
+        by_path[script.canonical_path] = id;
+        loaded.emplace(id, std::move(script));
+    }
+};
+
+static std::shared_ptr<const Program> load_script(Interpreter &in, const std::string &script_path) {
+    auto program = std::make_shared<Program>();
+    if (!compile_script(in, script_path, *program)) {
+        return nullptr;
+    }
+    return program;
+}
+
+static bool run_script(Interpreter &in, const std::string &script_path) {
+    struct stat st{};
+    if (fstatat(in.cwd_fd(), script_path.c_str(), &st, 0) != 0) {
+        in.err << "Error: cannot open '" << script_path << "'\n";
+        return false;
+    }
+
+    // Pipes and other special files cannot be re-read, so only regular
+    // files are remembered.
+    if (!S_ISREG(st.st_mode)) {
+        auto program = load_script(in, script_path);
+        if (!program) {
+            return false;
+        }
+        execute_program(in, *program);
+        return true;
+    }
+
+    FileId id{st.st_dev, st.st_ino};
+    for (std::size_t i = 0; i < in.script_stack.size(); ++i) {
+        if (in.script_stack[i].id == id) {
+            in.err << "Error: import cycle detected: ";
+            for (std::size_t j = i; j < in.script_stack.size(); ++j) {
+                in.err << in.script_stack[j].canonical_path << " -> ";
+            }
+            in.err << in.script_stack[i].canonical_path << '\n';
+            return false;
+        }
+    }
+
+    std::shared_ptr<const Program> program;
+    std::string canonical_path;
+    {
+        std::lock_guard<std::mutex> lock(in.scripts->mutex);
+        auto it = in.scripts->loaded.find(id);
+        if (it != in.scripts->loaded.end() &&
+            it->second.size == static_cast<std::uint64_t>(st.st_size) &&
+            it->second.mtime_ns == mtime_ns(st)) {
+            program = it->second.program;
+            canonical_path = it->second.canonical_path;
+            it->second.last_used = ++in.scripts->clock;
+        }
+    }
+    if (!program) {
+        program = load_script(in, script_path);
+        if (!program) {
+            return false;
+        }
+        std::string resolved = in.resolve(script_path);
+        char *canonical = realpath(resolved.c_str(), nullptr);
+        canonical_path = canonical ? canonical : resolved;
+        std::free(canonical);
+
+        std::lock_guard<std::mutex> lock(in.scripts->mutex);
+        in.scripts->insert(id, LoadedScript{canonical_path, static_cast<std::uint64_t>(st.st_size),
+                                            mtime_ns(st), program, 0});
+    }
+
+    in.script_stack.push_back(ActiveScript{id, std::move(canonical_path)});
+    execute_program(in, *program);
+    in.script_stack.pop_back();
+    return true;
+}
+
+// Executes commands from `fd` as they arrive. Input is read in large blocks
+// and every complete line in a block is compiled and run before the next
+// read, so a generator piping into nyns overlaps with execution instead of
+// having to finish first. A line longer than the block grows the buffer.
+static bool run_stream(Interpreter &in, int fd) {
+    constexpr std::size_t BLOCK = 256 * 1024;
+    std::vector<char> buf(BLOCK);
+    std::size_t have = 0;
+
+    for (;;) {
+        if (have == buf.size()) {
+            buf.resize(buf.size() * 2);
+        }
+        // Anything already produced should be visible while we wait.
+        flush_frame(in);
+        in.out.flush();
+        // poll() is never restarted after a signal, so a resize while we
+        // wait redraws the TUI for the new size; so does a size given by
+        // nyns_set_terminal_size(), which signals resize_fd.
+        pollfd fds[2] = {{fd, POLLIN, 0}, {in.resize_fd, POLLIN, 0}};
+        int ready = poll(fds, 2, -1);
+        if ((ready < 0 && errno == EINTR) || (ready > 0 && fds[1].revents != 0)) {
+            eventfd_t ignored;
+            if (ready > 0) {
+                eventfd_read(in.resize_fd, &ignored);
+            }
+            if (in.tui.resized() && in.ui_mode == NYNS_UI_TERMINAL) {
+                in.frame_pending = true;
+            }
+            continue;
+        }
+        ssize_t n = read(fd, buf.data() + have, buf.size() - have);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            report_errno(in.err, "Error reading standard input");
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        std::size_t scanned = have;
+        have += static_cast<std::size_t>(n);
+        const char *start = buf.data() + scanned;
+        const void *nl = memrchr(start, '\n', have - scanned);
+        if (!nl) {
+            continue;
+        }
+
+        std::size_t complete = static_cast<std::size_t>(static_cast<const char *>(nl) - buf.data()) + 1;
+        Program program;
+        ProgramBuilder pb(program);
+        compile_text(pb, std::string_view(buf.data(), complete));
+        pb.finish();
+        execute_program(in, program);
+
+        std::memmove(buf.data(), buf.data() + complete, have - complete);
+        have -= complete;
+    }
+
+    if (have > 0) {
+        Program program;
+        ProgramBuilder pb(program);
+        compile_text(pb, std::string_view(buf.data(), have));
+        pb.finish();
+        execute_program(in, program);
+    }
+    return true;
+}
+
+// Flattens a script and everything it imports into one self-contained
+// script. 'moveto' is followed the way execution would follow it, so each
+// import resolves against the directory that is current at that point; the
+// 'moveto' lines themselves are kept because later commands depend on them.
+// Bundling assumes the result runs from the directory it was bundled in,
+// just as the original entry script would have.
+class Bundler {
+public:
+    explicit Bundler(std::string &out) : out_(out) {}
+
+    bool bundle(const std::string &script_path, std::string &cwd) {
+        std::string path = join_path(cwd, script_path);
+        if (char *resolved = realpath(path.c_str(), nullptr)) {
+            path = resolved;
+            std::free(resolved);
+        }
+        for (const std::string &active : stack_) {
+            if (active == path) {
+                std::cerr << "Error: import cycle detected: ";
+                for (const std::string &p : stack_) {
+                    std::cerr << p << " -> ";
+                }
+                std::cerr << path << '\n';
+                return false;
+            }
+        }
+
+        ScriptSource source;
+        if (!source.open(AT_FDCWD, path, std::cerr)) {
+            return false;
+        }
+
+        stack_.push_back(path);
+        out_ += "# nyns bundle: begin ";
+        out_ += path;
+        out_ += '\n';
+
+        std::string_view text = source.text();
+        bool ok = true;
+        std::size_t pos = 0;
+        while (ok && pos < text.size()) {
+            std::size_t end = text.find('\n', pos);
+            if (end == std::string_view::npos) {
+                end = text.size();
+            }
+            std::string_view line = text.substr(pos, end - pos);
+            pos = end + 1;
+
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::size_t tok = 0;
+            std::string_view command_type = next_token(line, tok);
+            std::string_view arg1 = next_token(line, tok);
+            if (command_type == "import" && !arg1.empty()) {
+                ok = bundle(std::string(arg1), cwd);
+                continue;
+            }
+            if (command_type == "moveto" && !arg1.empty()) {
+                // A directory that cannot be resolved now would also fail
+                // to be entered at run time, leaving the cwd unchanged.
+                std::string target = join_path(cwd, std::string(arg1));
+                if (char *resolved = realpath(target.c_str(), nullptr)) {
+                    cwd = resolved;
+                    std::free(resolved);
+                }
+            }
+            out_.append(line.data(), line.size());
+            out_ += '\n';
+        }
+
+        out_ += "# nyns bundle: end ";
+        out_ += path;
+        out_ += '\n';
+        stack_.pop_back();
+        return ok;
+    }
+
+private:
+    static std::string join_path(const std::string &dir, const std::string &path) {
+        if (!path.empty() && path[0] == '/') {
+            return path;
+        }
+        return dir == "/" ? dir + path : dir + '/' + path;
+    }
+
+    std::string &out_;
+    std::vector<std::string> stack_;
+};
+
+// Compiled scripts are shared by every interpreter in the process.
+static std::shared_ptr<ScriptTable> shared_script_table() {
+    static auto table = std::make_shared<ScriptTable>();
+    return table;
+}
+
+struct nyns_interp {
+    nyns_interp()
+        : out_buf(STDOUT_FILENO, false), err_buf(STDERR_FILENO, true), out(&out_buf),
+          err(&err_buf), in(out, err, shared_script_table()) {
+        // As std::cerr is tied to std::cout: pending output is written
+        // before any error text, so the two stay in order in a shared log.
+        err.tie(&out);
+    }
+
+    SinkBuf out_buf;
+    SinkBuf err_buf;
+    std::ostream out;
+    std::ostream err;
+    Interpreter in;
+};
+
+// No C++ exception may cross the C interface; anything that escapes a
+// script run is reported on the interpreter's error stream instead.
+template <typename Fn>
+static int guarded_run(nyns_interp *interp, Fn fn) {
+    int rc;
+    try {
+        rc = fn() ? 0 : -1;
+        flush_frame(interp->in);
+        if (Interpreter &in = interp->in; in.final_state_pending) {
+            in.final_state_pending = false;
+            write_frame(in, in.tui.draw_plain(in.display_text, in.buttons, in.selected_button));
+        }
+        interp->in.tui.invalidate();
+        // Jobs nobody waited for are reported when the run ends, followed
+        // by what every 'adm' command of the run cost.
+        wait_for_jobs(interp->in, {});
+        if (!interp->in.adm_usage.empty()) {
+            print_adm_usage(interp->in, interp->err);
+            interp->in.adm_usage.clear();
+        }
+        if (g_frame_stats && interp->in.frame_stats.frames > 0) {
+            print_frame_stats(interp->in, interp->err);
+        }
+        interp->in.frame_stats = {};
+    } catch (const std::exception &e) {
+        interp->err << "Error: " << e.what() << '\n';
+        rc = -1;
+    } catch (...) {
+        interp->err << "Error: unexpected failure\n";
+        rc = -1;
+    }
+    interp->out.flush();
+    interp->err.flush();
+    return rc;
+}
+
+extern "C" {
+
+nyns_interp *nyns_create(void) {
+    try {
+        return new nyns_interp();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void nyns_destroy(nyns_interp *interp) {
+    if (interp) {
+        interp->out.flush();
+        delete interp;
+    }
+}
+
+void nyns_set_output(nyns_interp *interp, nyns_write_fn fn, void *user) {
+    interp->out_buf.set_callback(fn, user);
+    interp->in.tui.set_terminal_output(fn == nullptr);
+}
+
+void nyns_set_error(nyns_interp *interp, nyns_write_fn fn, void *user) {
+    interp->err_buf.set_callback(fn, user);
+}
+
+int nyns_set_cwd(nyns_interp *interp, const char *dir) {
+    return interp->in.change_directory(dir) ? 0 : -1;
+}
+
+int nyns_run_file(nyns_interp *interp, const char *path) {
+    return guarded_run(interp, [&] { return run_script(interp->in, path); });
+}
+
+int nyns_run_buffer(nyns_interp *interp, const char *data, size_t len) {
+    return guarded_run(interp, [&] {
+        Program program;
+        ProgramBuilder pb(program);
+        compile_text(pb, std::string_view(data, len));
+        pb.finish();
+        execute_program(interp->in, program);
+        return true;
+    });
+}
+
+int nyns_run_fd(nyns_interp *interp, int fd) {
+    return guarded_run(interp, [&] { return run_stream(interp->in, fd); });
+}
+
+void nyns_enable_cache(const char *dir) {
+    g_cache_dir = dir ? dir : default_cache_dir();
+}
+
+void nyns_set_job_limit(unsigned limit) {
+    g_job_limit = limit;
+}
+
+void nyns_set_frame_rate(unsigned fps) {
+    g_frame_interval_ns = fps > 0 ? 1000000000 / static_cast<std::int64_t>(fps) : 0;
+}
+
+void nyns_set_ui_mode(nyns_interp *interp, int mode) {
+    interp->in.ui_mode = mode;
+}
+
+void nyns_set_terminal_size(nyns_interp *interp, unsigned rows, unsigned cols) {
+    interp->in.tui.set_size(rows, cols);
+    if (interp->in.resize_fd >= 0) {
+        eventfd_write(interp->in.resize_fd, 1);
+    }
+}
+
+void nyns_terminal_resized(void) {
+    note_resize(SIGWINCH);
+}
+
+void nyns_set_frame_stats(int enable) {
+    g_frame_stats = enable != 0;
+}
+
+int nyns_bundle(const char *entry, const char *output_path) {
+    char *cwd = getcwd(nullptr, 0);
+    if (!cwd) {
+        std::perror("Error getting current directory");
+        return -1;
+    }
+    std::string dir = cwd;
+    std::free(cwd);
+
+    std::string bundled;
+    Bundler bundler(bundled);
+    if (!bundler.bundle(entry, dir)) {
+        return -1;
+    }
+
+    int fd = output_path ? ::open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)
+                         : STDOUT_FILENO;
+    if (fd < 0) {
+        std::perror(("Error: cannot open '" + std::string(output_path) + "'").c_str());
+        return -1;
+    }
+    const char *data = bundled.data();
+    std::size_t left = bundled.size();
+    while (left > 0) {
+        ssize_t n = write(fd, data, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        data += n;
+        left -= static_cast<std::size_t>(n);
+    }
+    if (output_path) {
+        close(fd);
+    }
+    if (left > 0) {
+        std::cerr << "Error: failed to write bundle '"
+                  << (output_path ? output_path : "<stdout>") << "'\n";
+        return -1;
+    }
+    return 0;
+}
+
+} // extern "C"
@@ -1,659 +1,638 @@
-// C++ port of bin/nyns.sh, with minimal external dependencies
+// Command-line front end for the nyns interpreter library (bin/libnyns.cpp)
 
-#include <cstdlib>
+#include "nyns.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
-#include <cerrno>
-#include <cstdint>
-#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-#include <arpa/inet.h>
-#include <ifaddrs.h>
-#include <netdb.h>
-#include <netinet/in.h>
-
-static bool remove_recursive(const std::string &path, bool force = false) {
-    struct stat st{};
-    if (lstat(path.c_str(), &st) != 0) {
-        if (errno == ENOENT && force) {
-            return true;
-        }
-        std::perror(("Error stating '" + path + "'").c_str());
+static bool read_manifest(const std::string &path, std::vector<std::string> &scripts) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Error: cannot open '" << path << "'\n";
         return false;
     }
-
-    if (S_ISDIR(st.st_mode)) {
-        DIR *dir = opendir(path.c_str());
-        if (!dir) {
-            std::perror(("Error opening directory '" + path + "'").c_str());
-            return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
         }
+        std::size_t end = line.find_first_of(" \t\r", start);
+        scripts.push_back(line.substr(start, end == std::string::npos ? end : end - start));
+    }
+    return true;
+}
 
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != nullptr) {
-            const char *name = entry->d_name;
-            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+static bool run_entry(nyns_interp *interp, const std::string &script) {
+    int rc = script == "-" ? nyns_run_fd(interp, STDIN_FILENO)
+                           : nyns_run_file(interp, script.c_str());
+    return rc == 0;
+}
+
+static void append_to_string(void *user, const char *data, size_t len) {
+    static_cast<std::string *>(user)->append(data, len);
+}
+
+// Runs every script in a fresh interpreter, so each starts exactly as it
+// would in a new process, then prints one status and timing line per script
+// to stderr. A script fails when it cannot be opened or compiled.
+//
+// With more than one job, scripts are handed out to a pool of threads. Each
+// script's output is captured and written out in one piece when it
+// finishes, so output from concurrent scripts never interleaves.
+static int run_batch(const std::vector<std::string> &scripts, unsigned jobs, int ui_mode) {
+    struct BatchResult {
+        bool ok;
+        double ms;
+    };
+    std::vector<BatchResult> results(scripts.size());
+    std::atomic<std::size_t> next{0};
+    std::mutex output_mutex;
+
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < scripts.size(); i = next++) {
+            auto start = std::chrono::steady_clock::now();
+            nyns_interp *interp = nyns_create();
+            if (!interp) {
+                results[i] = BatchResult{false, 0.0};
                 continue;
             }
-            std::string child = path;
-            if (!child.empty() && child.back() != '/') {
-                child += '/';
+            nyns_set_ui_mode(interp, ui_mode);
+            std::string out;
+            std::string err;
+            if (jobs > 1) {
+                nyns_set_output(interp, append_to_string, &out);
+                nyns_set_error(interp, append_to_string, &err);
             }
-            child += name;
-            remove_recursive(child, force);
-        }
-        closedir(dir);
-
-        if (rmdir(path.c_str()) != 0) {
-            if (!force) {
-                std::perror(("Error removing directory '" + path + "'").c_str());
+            bool ok = run_entry(interp, scripts[i]);
+            nyns_destroy(interp);
+            if (jobs > 1) {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::fwrite(out.data(), 1, out.size(), stdout);
+                std::fflush(stdout);
+                std::fwrite(err.data(), 1, err.size(), stderr);
             }
-            return force;
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            results[i] = BatchResult{ok, elapsed.count()};
         }
-        return true;
-    }
+    };
 
-    if (std::remove(path.c_str()) != 0) {
-        if (!force) {
-            std::perror(("Error removing file '" + path + "'").c_str());
+    std::size_t threads = std::min<std::size_t>(jobs, scripts.size());
+    if (threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> pool;
+        pool.reserve(threads);
+        for (std::size_t t = 0; t < threads; ++t) {
+            pool.emplace_back(worker);
         }
-        return force;
-    }
-    return true;
-}
-
-static bool mkdir_p(const std::string &path) {
-    if (path.empty() || path == ".") {
-        return true;
-    }
-    if (path == "/") {
-        return true;
-    }
-
-    struct stat st{};
-    if (stat(path.c_str(), &st) == 0) {
-        return S_ISDIR(st.st_mode);
-    }
-
-    std::size_t pos = path.rfind('/');
-    if (pos != std::string::npos && pos > 0) {
-        std::string parent = path.substr(0, pos);
-        if (!mkdir_p(parent)) {
-            return false;
+        for (std::thread &thread : pool) {
+            thread.join();
         }
     }
 
-    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
-        std::perror(("Error creating directory '" + path + "'").c_str());
-        return false;
-    }
-    return true;
-}
-
-static bool is_block_device(const std::string &path) {
-    struct stat st{};
-    if (stat(path.c_str(), &st) != 0) {
-        return false;
+    std::size_t failed = 0;
+    std::cerr << "nyns: batch summary\n";
+    for (std::size_t i = 0; i < scripts.size(); ++i) {
+        char line[64];
+        std::snprintf(line, sizeof(line), "  %-6s %10.3f ms  ", results[i].ok ? "ok" : "FAILED",
+                      results[i].ms);
+        std::cerr << line << scripts[i] << '\n';
+        failed += results[i].ok ? 0 : 1;
     }
-    return S_ISBLK(st.st_mode);
+    std::cerr << "nyns: " << failed << " of " << scripts.size() << " scripts failed\n";
+    return failed == 0 ? 0 : 1;
 }
 
-struct PartitionEntry {
-    std::uint8_t boot_indicator;
-    std::uint8_t start_chs[3];
-    std::uint8_t partition_type;
-    std::uint8_t end_chs[3];
-    std::uint32_t start_lba;
-    std::uint32_t size_sectors;
-} __attribute__((packed));
-
-static constexpr std::size_t MBR_PART_TABLE_OFFSET = 446;
-static constexpr std::size_t MBR_MAX_PARTITIONS = 4;
-
-// Simple in-memory representation of a TUI menu consisting of buttons
-// and a display text area.
-static std::vector<std::string> g_buttons;
-static int g_selected_button = -1;
-static std::string g_display_text;
-
-static void draw_tui_menu() {
-    // Clear screen and move cursor to top-left for a full-screen effect
-    std::cout << "\033[2J\033[H";
-
-    std::cout << "==== DISPLAY ====\n";
-    if (!g_display_text.empty()) {
-        std::cout << g_display_text << '\n';
-    } else {
-        std::cout << "(no display text)\n";
-    }
-    std::cout << "=================\n\n";
-
-    std::cout << "==== MENU ====\n";
-    if (g_buttons.empty()) {
-        std::cout << "(no buttons)\n";
-    } else {
-        for (std::size_t i = 0; i < g_buttons.size(); ++i) {
-            bool selected = (static_cast<int>(i) == g_selected_button);
-            const char *marker = selected ? "> " : "  ";
-            std::cout << marker << (i + 1) << ") [" << g_buttons[i] << "]\n";
+// --serve / --connect: a resident interpreter process on a Unix domain
+// socket, so a script run costs a connect instead of a process start.
+//
+// The client first sends, as one frame each, how its TUI should be shown
+// (one NYNS_UI_* byte chosen from its own flags and standard output), the
+// size of its terminal and its working directory:
+//   'u' <byte>            UI mode
+//   'w' <uint16 rows> <uint16 columns>, 0 when unknown
+//   'c' <path>            working directory
+// Then it sends the script, and its terminal size again whenever that
+// changes, until it shuts down its sending side:
+//   'i' <bytes>           script text
+//   'w'                   as above
+// The server runs the script in a fresh interpreter starting in that
+// directory, executing lines as they arrive, and answers with frames:
+//   'o' <bytes>   standard output
+//   'e' <bytes>   error output
+//   'x' <int32>   run status, last frame on the connection
+// A frame is one type byte, a 32-bit little-endian payload length and the
+// payload; integers inside payloads are little-endian too. Output of
+// commands started by 'adm' is sent the same way.
+static constexpr char FRAME_UI = 'u';
+static constexpr char FRAME_SIZE = 'w';
+static constexpr char FRAME_CWD = 'c';
+static constexpr char FRAME_INPUT = 'i';
+static constexpr char FRAME_STDOUT = 'o';
+static constexpr char FRAME_STDERR = 'e';
+static constexpr char FRAME_EXIT = 'x';
+
+// The longest 'i' frame a client sends and the server accepts.
+static constexpr std::uint32_t MAX_INPUT_FRAME = 256 * 1024;
+
+static bool write_all(int fd, const char *data, std::size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
         }
+        data += n;
+        len -= static_cast<std::size_t>(n);
     }
-    std::cout << "==============\n";
+    return true;
 }
 
-static void print_ip_addresses() {
-    struct ifaddrs *ifaddr = nullptr;
-    if (getifaddrs(&ifaddr) == -1) {
-        std::perror("Error getting network interfaces");
-        return;
-    }
-
-    for (struct ifaddrs *ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
-        if (!ifa->ifa_addr) {
+static bool read_exact(int fd, char *data, std::size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, data, len);
+        if (n < 0 && errno == EINTR) {
             continue;
         }
-        int family = ifa->ifa_addr->sa_family;
-        char host[NI_MAXHOST];
-
-        if (family == AF_INET) {
-            auto *addr = reinterpret_cast<sockaddr_in *>(ifa->ifa_addr);
-            if (inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host))) {
-                std::cout << ifa->ifa_name << " IPv4 " << host << '\n';
-            }
-        } else if (family == AF_INET6) {
-            auto *addr6 = reinterpret_cast<sockaddr_in6 *>(ifa->ifa_addr);
-            if (inet_ntop(AF_INET6, &addr6->sin6_addr, host, sizeof(host))) {
-                std::cout << ifa->ifa_name << " IPv6 " << host << '\n';
-            }
+        if (n <= 0) {
+            return false;
         }
+        data += n;
+        len -= static_cast<std::size_t>(n);
     }
-
-    freeifaddrs(ifaddr);
+    return true;
 }
 
-static void print_mbr_partitions(const std::string &device) {
-    std::ifstream dev(device, std::ios::binary);
-    if (!dev) {
-        std::cerr << "Error: cannot open device '" << device << "'\n";
-        return;
+static bool send_frame(int fd, char type, const char *data, std::size_t len) {
+    char header[5];
+    header[0] = type;
+    for (int i = 0; i < 4; ++i) {
+        header[1 + i] = static_cast<char>((len >> (8 * i)) & 0xFF);
     }
+    return write_all(fd, header, sizeof(header)) && write_all(fd, data, len);
+}
 
-    unsigned char sector[512];
-    dev.read(reinterpret_cast<char *>(sector), sizeof(sector));
-    if (dev.gcount() != static_cast<std::streamsize>(sizeof(sector))) {
-        std::cerr << "Error: could not read MBR from '" << device << "'\n";
-        return;
+// Fails on a payload longer than `max_len`, which is not read.
+static bool read_frame(int fd, char &type, std::string &payload,
+                       std::uint32_t max_len = UINT32_MAX) {
+    char header[5];
+    if (!read_exact(fd, header, sizeof(header))) {
+        return false;
     }
-
-    if (sector[510] != 0x55 || sector[511] != 0xAA) {
-        std::cerr << "Warning: '" << device << "' does not appear to have a valid MBR signature\n";
+    type = header[0];
+    std::uint32_t len = 0;
+    for (int i = 0; i < 4; ++i) {
+        len |= static_cast<std::uint32_t>(static_cast<unsigned char>(header[1 + i])) << (8 * i);
     }
+    if (len > max_len) {
+        return false;
+    }
+    payload.resize(len);
+    return read_exact(fd, &payload[0], len);
+}
 
-    for (std::size_t i = 0; i < MBR_MAX_PARTITIONS; ++i) {
-        auto *entry = reinterpret_cast<const PartitionEntry *>(
-            sector + MBR_PART_TABLE_OFFSET + i * sizeof(PartitionEntry));
-
-        if (entry->partition_type == 0 || entry->size_sectors == 0) {
-            continue;
-        }
+struct ClientStream {
+    int fd;
+    char type;
+    bool broken;
+};
 
-        std::cout << "Partition " << (i + 1) << ": "
-                  << "boot=" << (entry->boot_indicator == 0x80 ? "yes" : "no")
-                  << ", type=0x" << std::hex << static_cast<int>(entry->partition_type)
-                  << std::dec
-                  << ", start_lba=" << entry->start_lba
-                  << ", sectors=" << entry->size_sectors
-                  << '\n';
+static void send_to_client(void *user, const char *data, size_t len) {
+    auto *stream = static_cast<ClientStream *>(user);
+    if (!stream->broken && !send_frame(stream->fd, stream->type, data, len)) {
+        stream->broken = true;
     }
 }
 
-static bool wipe_mbr_partition_table(const std::string &device) {
-    if (device.rfind("/dev/", 0) == 0 || is_block_device(device)) {
-        std::cerr << "Refusing to modify real block device '" << device
-                  << "'. Use a disk image file instead.\n";
+// Applies a 'w' frame's payload to `interp`.
+static bool set_terminal_size(nyns_interp *interp, const std::string &size) {
+    if (size.size() != 4) {
         return false;
     }
+    auto u16 = [&](std::size_t at) {
+        return static_cast<unsigned>(static_cast<unsigned char>(size[at])) |
+               static_cast<unsigned>(static_cast<unsigned char>(size[at + 1])) << 8;
+    };
+    nyns_set_terminal_size(interp, u16(0), u16(2));
+    return true;
+}
 
-    std::fstream dev(device, std::ios::in | std::ios::out | std::ios::binary);
-    if (!dev) {
-        std::cerr << "Error: cannot open device/image '" << device << "' for writing\n";
-        return false;
+// Passes the script from the client's 'i' frames on to `script_fd`, which
+// the interpreter reads, and applies its 'w' frames, until the client stops
+// sending or the interpreter stops reading.
+static void relay_input(int conn, int script_fd, nyns_interp *interp) {
+    char type = 0;
+    std::string payload;
+    while (read_frame(conn, type, payload, MAX_INPUT_FRAME)) {
+        if (type == FRAME_INPUT) {
+            if (!write_all(script_fd, payload.data(), payload.size())) {
+                break;
+            }
+        } else if (type != FRAME_SIZE || !set_terminal_size(interp, payload)) {
+            break;
+        }
     }
+    shutdown(script_fd, SHUT_WR);
+}
 
-    unsigned char sector[512];
-    dev.read(reinterpret_cast<char *>(sector), sizeof(sector));
-    if (dev.gcount() != static_cast<std::streamsize>(sizeof(sector))) {
-        std::cerr << "Error: could not read MBR from '" << device << "'\n";
-        return false;
-    }
+static void serve_connection(int conn) {
+    char type = 0;
+    std::string ui;
+    std::string size;
+    std::string cwd;
+    nyns_interp *interp = nullptr;
+    // The handshake comes from whoever can connect, so its sizes and the
+    // UI mode are checked before anything is allocated or applied.
+    if (read_frame(conn, type, ui, 1) && type == FRAME_UI && ui.size() == 1 &&
+        ui[0] >= NYNS_UI_TERMINAL && ui[0] <= NYNS_UI_FINAL &&
+        read_frame(conn, type, size, 4) && type == FRAME_SIZE && size.size() == 4 &&
+        read_frame(conn, type, cwd, PATH_MAX) && type == FRAME_CWD) {
+        interp = nyns_create();
+    }
+    if (interp) {
+        nyns_set_ui_mode(interp, ui[0]);
+        set_terminal_size(interp, size);
+        ClientStream out{conn, FRAME_STDOUT, false};
+        ClientStream err{conn, FRAME_STDERR, false};
+        nyns_set_output(interp, send_to_client, &out);
+        nyns_set_error(interp, send_to_client, &err);
+
+        // The script reaches the interpreter through a socket pair, so that
+        // size changes can be taken out of the stream on their own thread.
+        std::int32_t rc = -1;
+        int script[2];
+        if (nyns_set_cwd(interp, cwd.c_str()) != 0) {
+            std::string msg = "Error: cannot enter '" + cwd + "'\n";
+            send_to_client(&err, msg.data(), msg.size());
+        } else if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, script) != 0) {
+            std::string msg = "Error: cannot start the script: " + std::string(std::strerror(errno)) + "\n";
+            send_to_client(&err, msg.data(), msg.size());
+        } else {
+            std::thread relay(relay_input, conn, script[1], interp);
+            rc = nyns_run_fd(interp, script[0]);
+            // Unblocks the relay whether it is writing the script or
+            // waiting for the client.
+            close(script[0]);
+            shutdown(conn, SHUT_RD);
+            relay.join();
+            close(script[1]);
+        }
+        nyns_destroy(interp);
 
-    if (sector[510] != 0x55 || sector[511] != 0xAA) {
-        std::cerr << "Warning: '" << device
-                  << "' does not have a valid MBR signature; writing anyway\n";
+        char status[4];
+        for (int i = 0; i < 4; ++i) {
+            status[i] = static_cast<char>((static_cast<std::uint32_t>(rc) >> (8 * i)) & 0xFF);
+        }
+        send_frame(conn, FRAME_EXIT, status, sizeof(status));
     }
+    close(conn);
+}
 
-    std::memset(sector + 446, 0, 64);
-    dev.seekp(0);
-    dev.write(reinterpret_cast<const char *>(sector), sizeof(sector));
-    if (!dev) {
-        std::cerr << "Error: failed to write updated MBR to '" << device << "'\n";
+static bool make_socket_address(const char *path, sockaddr_un &addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: socket path '" << path << "' is too long\n";
         return false;
     }
-
-    dev.flush();
+    std::strcpy(addr.sun_path, path);
     return true;
 }
 
-static bool add_single_partition(const std::string &device) {
-    if (device.rfind("/dev/", 0) == 0 || is_block_device(device)) {
-        std::cerr << "Refusing to modify real block device '" << device
-                  << "'. Use a disk image file instead.\n";
-        return false;
-    }
+static char g_socket_path[sizeof(sockaddr_un::sun_path)];
 
-    std::fstream dev(device, std::ios::in | std::ios::out | std::ios::binary);
-    if (!dev) {
-        std::cerr << "Error: cannot open device/image '" << device << "' for writing\n";
-        return false;
-    }
+static void remove_socket_and_exit(int sig) {
+    unlink(g_socket_path);
+    _exit(128 + sig);
+}
 
-    dev.seekg(0, std::ios::end);
-    std::streamoff file_size = dev.tellg();
-    if (file_size <= 0) {
-        std::cerr << "Error: could not determine size of '" << device << "'\n";
-        return false;
+static int serve(const char *path) {
+    sockaddr_un addr;
+    if (!make_socket_address(path, addr)) {
+        return 1;
     }
-    if (file_size < static_cast<std::streamoff>(512 * 2)) {
-        std::cerr << "Error: image '" << device << "' is too small for a partition table\n";
-        return false;
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        std::perror("Error creating socket");
+        return 1;
     }
 
-    std::uint64_t total_sectors64 = static_cast<std::uint64_t>(file_size / 512);
-    if (total_sectors64 > 0xFFFFFFFFu) {
-        std::cerr << "Error: image '" << device << "' is too large for 32-bit LBA\n";
-        return false;
+    // Only replace a stale socket, never some other file.
+    struct stat st{};
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    mode_t old_mask = umask(0177);
+    int rc = bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    umask(old_mask);
+    if (rc != 0 || listen(listener, SOMAXCONN) != 0) {
+        std::perror(("Error listening on '" + std::string(path) + "'").c_str());
+        close(listener);
+        return 1;
     }
-    std::uint32_t total_sectors = static_cast<std::uint32_t>(total_sectors64);
 
-    dev.seekg(0);
-    unsigned char sector[512];
-    dev.read(reinterpret_cast<char *>(sector), sizeof(sector));
-    if (dev.gcount() != static_cast<std::streamsize>(sizeof(sector))) {
-        std::cerr << "Error: could not read MBR from '" << device << "'\n";
-        return false;
-    }
+    std::strcpy(g_socket_path, path);
+    std::signal(SIGINT, remove_socket_and_exit);
+    std::signal(SIGTERM, remove_socket_and_exit);
+    std::signal(SIGPIPE, SIG_IGN);
 
-    if (sector[510] != 0x55 || sector[511] != 0xAA) {
-        std::memset(sector, 0, sizeof(sector));
-        sector[510] = 0x55;
-        sector[511] = 0xAA;
-    }
-
-    auto *entries = reinterpret_cast<PartitionEntry *>(sector + MBR_PART_TABLE_OFFSET);
-    for (std::size_t i = 0; i < MBR_MAX_PARTITIONS; ++i) {
-        if (entries[i].partition_type != 0 && entries[i].size_sectors != 0) {
-            std::cerr << "Error: existing partition entries found on '" << device
-                      << "'. Use 'partition " << device << " clean' first.\n";
-            return false;
+    for (;;) {
+        int conn = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                continue;
+            }
+            std::perror("Error accepting connection");
+            break;
         }
+        std::thread(serve_connection, conn).detach();
     }
+    close(listener);
+    unlink(path);
+    return 1;
+}
 
-    PartitionEntry &p = entries[0];
-    std::memset(&p, 0, sizeof(p));
-    p.boot_indicator = 0x00;
-    p.partition_type = 0x83; // Linux filesystem
-    p.start_lba = 1;
-    p.size_sectors = total_sectors - 1;
+// Written to by the client's SIGWINCH handler, for the thread sending the
+// script to pass the new size on.
+static int g_winch_pipe[2] = {-1, -1};
 
-    dev.seekp(0);
-    dev.write(reinterpret_cast<const char *>(sector), sizeof(sector));
-    if (!dev) {
-        std::cerr << "Error: failed to write updated MBR to '" << device << "'\n";
-        return false;
-    }
-
-    dev.flush();
-    return true;
+static void note_winch(int) {
+    int saved = errno;
+    char byte = 0;
+    ssize_t ignored = write(g_winch_pipe[1], &byte, 1);
+    (void)ignored;
+    errno = saved;
 }
 
-static bool create_image_with_partition(const std::string &image) {
-    if (image.rfind("/dev/", 0) == 0 || is_block_device(image)) {
-        std::cerr << "Refusing to create image on real block device path '" << image
-                  << "'. Use a regular file path instead.\n";
-        return false;
+// Sends a 'w' frame with the size of the terminal on standard output.
+static bool send_terminal_size(int conn) {
+    winsize ws{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0) {
+        ws = winsize{};
     }
+    char size[4] = {static_cast<char>(ws.ws_row & 0xFF), static_cast<char>(ws.ws_row >> 8),
+                    static_cast<char>(ws.ws_col & 0xFF), static_cast<char>(ws.ws_col >> 8)};
+    return send_frame(conn, FRAME_SIZE, size, sizeof(size));
+}
 
-    struct stat st{};
-    if (stat(image.c_str(), &st) == 0) {
-        std::cerr << "Error: image '" << image << "' already exists\n";
-        return false;
+// Sends the script on its own thread while the main thread demultiplexes
+// the reply, so a chatty script cannot deadlock against a full socket.
+static int connect_and_run(const char *path, const std::string &script, int ui_mode) {
+    sockaddr_un addr;
+    if (!make_socket_address(path, addr)) {
+        return 1;
     }
-
-    std::size_t slash_pos = image.rfind('/');
-    if (slash_pos != std::string::npos && slash_pos > 0) {
-        std::string parent = image.substr(0, slash_pos);
-        if (!mkdir_p(parent)) {
-            return false;
+    int input = STDIN_FILENO;
+    if (script != "-") {
+        input = ::open(script.c_str(), O_RDONLY | O_CLOEXEC);
+        if (input < 0) {
+            std::cerr << "Error: cannot open '" << script << "'\n";
+            return 1;
         }
     }
-
-    constexpr std::uint32_t sectors = 1024; // 512 KiB image
-    constexpr std::uint64_t image_size = static_cast<std::uint64_t>(sectors) * 512u;
-
-    std::fstream dev(image, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!dev) {
-        std::cerr << "Error: cannot create image '" << image << "'\n";
-        return false;
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || connect(conn, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        std::perror(("Error connecting to '" + std::string(path) + "'").c_str());
+        return 1;
     }
 
-    unsigned char sector[512];
-    std::memset(sector, 0, sizeof(sector));
-    sector[510] = 0x55;
-    sector[511] = 0xAA;
-
-    auto *entries = reinterpret_cast<PartitionEntry *>(sector + MBR_PART_TABLE_OFFSET);
-    std::memset(entries, 0, sizeof(PartitionEntry) * MBR_MAX_PARTITIONS);
-
-    PartitionEntry &p = entries[0];
-    p.boot_indicator = 0x00;
-    p.partition_type = 0x83; // Linux filesystem
-    p.start_lba = 1;
-    p.size_sectors = sectors - 1;
-
-    dev.write(reinterpret_cast<const char *>(sector), sizeof(sector));
-    if (!dev) {
-        std::cerr << "Error: failed to write MBR to new image '" << image << "'\n";
-        return false;
+    // Resizes only matter to a terminal on standard output.
+    if (isatty(STDOUT_FILENO) && pipe2(g_winch_pipe, O_NONBLOCK | O_CLOEXEC) == 0) {
+        struct sigaction sa {};
+        sa.sa_handler = note_winch;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGWINCH, &sa, nullptr);
     }
 
-    dev.seekp(static_cast<std::streamoff>(image_size) - 1);
-    char zero = 0;
-    dev.write(&zero, 1);
-    if (!dev) {
-        std::cerr << "Error: failed to resize image '" << image << "'\n";
-        return false;
+    char ui = static_cast<char>(ui_mode);
+    char *cwd = getcwd(nullptr, 0);
+    bool sent = cwd && send_frame(conn, FRAME_UI, &ui, 1) && send_terminal_size(conn) &&
+                send_frame(conn, FRAME_CWD, cwd, std::strlen(cwd));
+    std::free(cwd);
+    if (!sent) {
+        std::perror("Error sending request");
+        close(conn);
+        return 1;
     }
 
-    dev.flush();
-    return true;
-}
-
-static void interpret_command(const std::string &line);
+    // Also stops when the connection is shut down, in case the server
+    // finishes while we wait for input.
+    std::thread sender([conn, input]() {
+        std::vector<char> buf(MAX_INPUT_FRAME);
+        pollfd fds[3] = {{input, POLLIN, 0}, {g_winch_pipe[0], POLLIN, 0}, {conn, 0, 0}};
+        for (;;) {
+            if (poll(fds, 3, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[2].revents != 0) {
+                break;
+            }
+            if (fds[1].revents != 0) {
+                char drain[64];
+                while (read(g_winch_pipe[0], drain, sizeof(drain)) > 0) {
+                }
+                if (!send_terminal_size(conn)) {
+                    break;
+                }
+            }
+            if (fds[0].revents == 0) {
+                continue;
+            }
+            ssize_t n = read(input, buf.data(), buf.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0 || !send_frame(conn, FRAME_INPUT, buf.data(), static_cast<std::size_t>(n))) {
+                break;
+            }
+        }
+        shutdown(conn, SHUT_WR);
+    });
 
-static void run_script(const std::string &script_path) {
-    std::ifstream in(script_path);
-    if (!in) {
-        std::cerr << "Error: cannot open '" << script_path << "'\n";
-        return;
+    int status = 1;
+    char type = 0;
+    std::string payload;
+    while (read_frame(conn, type, payload)) {
+        if (type == FRAME_STDOUT) {
+            std::fwrite(payload.data(), 1, payload.size(), stdout);
+            std::fflush(stdout);
+        } else if (type == FRAME_STDERR) {
+            std::fwrite(payload.data(), 1, payload.size(), stderr);
+        } else if (type == FRAME_EXIT && payload.size() == 4) {
+            status = payload == std::string(4, '\0') ? 0 : 1;
+            break;
+        }
+    }
+    if (type != FRAME_EXIT) {
+        std::cerr << "Error: connection to '" << path << "' closed unexpectedly\n";
     }
 
-    std::string line;
-    while (std::getline(in, line)) {
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
-        if (line.empty() || (!line.empty() && line[0] == '#')) {
-            continue;
-        }
-        interpret_command(line);
+    // Unblocks the sender if the server finished before reading all input.
+    shutdown(conn, SHUT_RDWR);
+    sender.join();
+    close(conn);
+    if (input != STDIN_FILENO) {
+        close(input);
     }
+    return status;
 }
 
-static void interpret_command(const std::string &line) {
-    std::istringstream iss(line);
-    std::string command_type;
-    std::string arg1;
-    std::string arg2;
-
-    if (!(iss >> command_type)) {
-        return;
-    }
-
-    // Mimic: read -r command_type arg1 arg2 <<< "$1"
-    iss >> arg1;
-    iss >> arg2;
-
-    // Capture the remaining text on the line (if any), typically used for
-    // commands that need more than two arguments, like button labels or
-    // display text.
-    std::string rest_of_line;
-    std::getline(iss, rest_of_line);
-    if (!rest_of_line.empty()) {
-        // Trim leading spaces from the leftover text.
-        std::size_t first_non_space = rest_of_line.find_first_not_of(' ');
-        if (first_non_space != std::string::npos) {
-            rest_of_line.erase(0, first_non_space);
-        } else {
-            rest_of_line.clear();
-        }
-    }
+static void print_usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " [--cache] <script.nyns>...\n";
+    std::cerr << "       " << argv0 << " [--cache] [-]   (read commands from stdin)\n";
+    std::cerr << "       " << argv0 << " [--cache] --manifest <list.txt>\n";
+    std::cerr << "       " << argv0 << " --bundle <entry.nyns> [-o <out.nyns>]\n";
+    std::cerr << "       " << argv0 << " --serve <socket>\n";
+    std::cerr << "       " << argv0 << " --connect <socket> [<script.nyns> | -]\n";
+    std::cerr << "  --cache     Reuse compiled scripts from $NYNS_CACHE_DIR,\n";
+    std::cerr << "              $XDG_CACHE_HOME/nyns or ~/.cache/nyns\n";
+    std::cerr << "  --manifest  Run the scripts listed one per line in <list.txt>\n";
+    std::cerr << "  --jobs N    Run up to N scripts of a batch concurrently\n";
+    std::cerr << "  --adm-jobs N  Keep at most N background 'adm' jobs per script\n";
+    std::cerr << "                running (default: 16)\n";
+    std::cerr << "  --fps N     Also redraw the TUI up to N times a second during\n";
+    std::cerr << "              long runs of UI commands\n";
+    std::cerr << "  --headless  Print display text and selection changes as plain\n";
+    std::cerr << "              lines instead of drawing the TUI (the default when\n";
+    std::cerr << "              standard output is not a terminal)\n";
+    std::cerr << "  --headless=final  Print only the final TUI state, as plain text\n";
+    std::cerr << "  --tui       Draw the TUI even when output is not a terminal\n";
+    std::cerr << "  --frame-stats  Report the frames, bytes and writes spent\n";
+    std::cerr << "                 drawing the TUI at the end of each script\n";
+    std::cerr << "  --bundle    Inline every import of <entry.nyns> into one script\n";
+    std::cerr << "  --serve     Run scripts sent to <socket> in this process\n";
+    std::cerr << "  --connect   Run a script, or stdin, on a --serve process\n";
+    std::cerr << "Several scripts run in sequence in one process, each starting from\n";
+    std::cerr << "a clean state, followed by a per-script status and timing summary.\n";
+}
 
-    if (command_type == "echo") {
-        std::string text;
-        if (!arg1.empty()) {
-            text += arg1;
-        }
-        if (!arg2.empty()) {
-            if (!text.empty()) {
-                text += ' ';
-            }
-            text += arg2;
-        }
-        g_display_text = text;
-        std::cout << text << '\n';
-        draw_tui_menu();
-    } else if (command_type == "+") {
-        try {
-            long long a = std::stoll(arg1);
-            long long b = std::stoll(arg2);
-            std::cout << (a + b) << '\n';
-        } catch (...) {
-            std::cerr << "Error: invalid numbers for '+'\n";
-        }
-    } else if (command_type == "-") {
-        try {
-            long long a = std::stoll(arg1);
-            long long b = std::stoll(arg2);
-            std::cout << (a - b) << '\n';
-        } catch (...) {
-            std::cerr << "Error: invalid numbers for '-'\n";
-        }
-    } else if (command_type == "rem") {
-        // Equivalent to: rm -rf path, with optional -f
-        if (arg1.empty()) {
-            std::cerr << "Error: 'rem' requires a path\n";
-            return;
-        }
-        bool force = false;
-        std::string target = arg1;
-        if (arg1 == "-f") {
-            force = true;
-            target = arg2;
-            if (target.empty()) {
-                std::cerr << "Error: 'rem -f' requires a path\n";
-                return;
-            }
-        }
-        if (!remove_recursive(target, force) && !force) {
-            std::cerr << "Error removing '" << target << "'\n";
-        }
-    } else if (command_type == "moveto") {
-        if (arg1.empty()) {
-            std::cerr << "Error: 'moveto' requires a directory\n";
-            return;
-        }
-        if (chdir(arg1.c_str()) != 0) {
-            std::perror(("Error changing directory to '" + arg1 + "'").c_str());
-        }
-    } else if (command_type == "help") {
-        std::cout << "echo: Displays text on-screen\n";
-        std::cout << "+: Addition\n";
-        std::cout << "-: Removal of number\n";
-        std::cout << "rem: Delete a path (irreversible)\n";
-        std::cout << "rem arguments: -f: Forced deletion\n";
-        std::cout << "moveto: CD into a directory\n";
-        std::cout << "help: Get command help\n";
-        std::cout << "ip: Get IP address information\n";
-        std::cout << "create: Create a file\n";
-        std::cout << "import: Import a script\n";
-        std::cout << "adm: Run a command as admin (requires root)\n";
-        std::cout << "partition: Show or modify MBR on a disk image\n";
-        std::cout << "           Usage: partition <image> [clean|add|create]\n";
-        std::cout << "button: TUI buttons and selection\n";
-        std::cout << "        button add -text <label>\n";
-        std::cout << "        button select <index>\n";
-        std::cout << "        button next / button prev\n";
-        std::cout << "display: Change TUI display text\n";
-        std::cout << "         display -change <text>\n";
-    } else if (command_type == "ip") {
-        print_ip_addresses();
-    } else if (command_type == "create") {
-        if (arg1.empty()) {
-            std::cerr << "Error: 'create' requires a filename\n";
-            return;
-        }
-        std::ofstream ofs(arg1);
-        if (!ofs) {
-            std::cerr << "Error creating file '" << arg1 << "'\n";
-        }
-    } else if (command_type == "import") {
-        if (arg1.empty()) {
-            std::cerr << "Error: 'import' requires a script path\n";
-            return;
-        }
-        run_script(arg1);
-    } else if (command_type == "adm") {
-        if (arg1.empty()) {
-            std::cerr << "Error: 'adm' requires a command\n";
-            return;
-        }
-        if (geteuid() != 0) {
-            std::cerr << "Error: 'adm' requires root privileges (run nyns as root)\n";
-            return;
-        }
-        int rc = std::system(arg1.c_str());
-        if (rc == -1) {
-            std::perror("Error running admin command");
-        }
-    } else if (command_type == "button") {
-        if (arg1 == "add" && arg2 == "-text") {
-            if (rest_of_line.empty()) {
-                std::cerr << "Error: 'button add -text' requires a label\n";
-                return;
-            }
-            g_buttons.push_back(rest_of_line);
-            if (g_selected_button < 0) {
-                g_selected_button = 0;
-            }
-            draw_tui_menu();
-        } else if (arg1 == "select") {
-            if (arg2.empty()) {
-                std::cerr << "Error: 'button select' requires an index\n";
-                return;
-            }
-            if (g_buttons.empty()) {
-                std::cerr << "Error: no buttons to select\n";
-                return;
-            }
-            try {
-                int idx = std::stoi(arg2);
-                if (idx < 1 || idx > static_cast<int>(g_buttons.size())) {
-                    std::cerr << "Error: button index out of range\n";
-                    return;
-                }
-                g_selected_button = idx - 1;
-                draw_tui_menu();
-            } catch (...) {
-                std::cerr << "Error: invalid index for 'button select'\n";
-            }
-        } else if (arg1 == "next") {
-            if (g_buttons.empty()) {
-                std::cerr << "Error: no buttons to navigate\n";
-                return;
-            }
-            if (g_selected_button < 0 ||
-                g_selected_button >= static_cast<int>(g_buttons.size())) {
-                g_selected_button = 0;
-            } else {
-                g_selected_button =
-                    (g_selected_button + 1) % static_cast<int>(g_buttons.size());
-            }
-            draw_tui_menu();
-        } else if (arg1 == "prev") {
-            if (g_buttons.empty()) {
-                std::cerr << "Error: no buttons to navigate\n";
-                return;
+int main(int argc, char *argv[]) {
+    // The library writes through its own buffers; the CLI's iostreams need
+    // no synchronization with stdio and are flushed where output matters.
+    std::ios::sync_with_stdio(false);
+    std::vector<std::string> scripts;
+    const char *output_path = nullptr;
+    bool bundle = false;
+    bool batch = false;
+    unsigned jobs = 1;
+    const char *serve_path = nullptr;
+    const char *connect_path = nullptr;
+    int ui_mode = -1; // Chosen from standard output unless given
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--cache") {
+            nyns_enable_cache(nullptr);
+        } else if (arg == "--bundle") {
+            bundle = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "--manifest" && i + 1 < argc) {
+            if (!read_manifest(argv[++i], scripts)) {
+                return 1;
             }
-            if (g_selected_button < 0 ||
-                g_selected_button >= static_cast<int>(g_buttons.size())) {
-                g_selected_button = 0;
-            } else {
-                g_selected_button =
-                    (g_selected_button - 1 + static_cast<int>(g_buttons.size())) %
-                    static_cast<int>(g_buttons.size());
+            batch = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (arg == "--connect" && i + 1 < argc) {
+            connect_path = argv[++i];
+        } else if (arg == "--fps" && i + 1 < argc) {
+            nyns_set_frame_rate(static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        } else if (arg == "--headless") {
+            ui_mode = NYNS_UI_EVENTS;
+        } else if (arg == "--headless=final") {
+            ui_mode = NYNS_UI_FINAL;
+        } else if (arg == "--tui") {
+            ui_mode = NYNS_UI_TERMINAL;
+        } else if (arg == "--frame-stats") {
+            nyns_set_frame_stats(1);
+        } else if (arg == "--adm-jobs" && i + 1 < argc) {
+            nyns_set_job_limit(static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            if (jobs == 0) {
+                jobs = std::max(1u, std::thread::hardware_concurrency());
             }
-            draw_tui_menu();
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            print_usage(argv[0]);
+            return 1;
         } else {
-            std::cerr << "Error: unknown 'button' usage. Expected one of:\n";
-            std::cerr << "  button add -text <label>\n";
-            std::cerr << "  button select <index>\n";
-            std::cerr << "  button next\n";
-            std::cerr << "  button prev\n";
+            scripts.emplace_back(arg);
         }
-    } else if (command_type == "display") {
-        if (arg1 == "-change") {
-            std::string new_text = !rest_of_line.empty() ? rest_of_line : arg2;
-            if (new_text.empty()) {
-                std::cerr << "Error: 'display -change' requires text\n";
-                return;
-            }
-            g_display_text = new_text;
-            draw_tui_menu();
-        } else {
-            std::cerr << "Error: unknown 'display' usage. Expected: display -change <text>\n";
+    }
+    if (serve_path) {
+        // Each client chooses how its own TUI is shown.
+        if (!scripts.empty() || bundle || batch || connect_path || ui_mode >= 0) {
+            print_usage(argv[0]);
+            return 1;
         }
-    } else if (command_type == "partition") {
-        if (arg1.empty()) {
-            std::cerr << "Error: 'partition' requires a device or image path\n";
-            return;
+        return serve(serve_path);
+    }
+    if (ui_mode < 0) {
+        ui_mode = isatty(STDOUT_FILENO) == 1 ? NYNS_UI_TERMINAL : NYNS_UI_EVENTS;
+    }
+    if (scripts.empty() && !bundle && !batch && !isatty(STDIN_FILENO)) {
+        scripts.emplace_back("-");
+    }
+    if (connect_path) {
+        if (scripts.size() != 1 || bundle || batch) {
+            print_usage(argv[0]);
+            return 1;
         }
-        if (arg2 == "wipe" || arg2 == "clean") {
-            if (wipe_mbr_partition_table(arg1)) {
-                std::cout << "MBR partition table cleaned on '" << arg1 << "'\n";
-            }
-        } else if (arg2 == "add") {
-            if (add_single_partition(arg1)) {
-                std::cout << "Single primary partition added on '" << arg1 << "'\n";
-            }
-        } else if (arg2 == "create") {
-            if (create_image_with_partition(arg1)) {
-                std::cout << "Disk image created with single primary partition at '" << arg1 << "'\n";
-            }
-        } else if (arg2.empty()) {
-            print_mbr_partitions(arg1);
-        } else {
-            std::cerr << "Error: unknown partition action '" << arg2
-                      << "'. Use no action, 'clean', or 'add'.\n";
+        return connect_and_run(connect_path, scripts[0], ui_mode);
+    }
+    if (bundle) {
+        if (scripts.size() != 1) {
+            print_usage(argv[0]);
+            return 1;
         }
-    } else {
-        std::cerr << "Error: Unknown command '" << command_type << "'\n";
+        return nyns_bundle(scripts[0].c_str(), output_path) == 0 ? 0 : 1;
     }
-}
-
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <script.nyns>\n";
+    if (output_path || (scripts.empty() && !batch)) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    run_script(argv[1]);
+    if (batch || scripts.size() > 1) {
+        return run_batch(scripts, jobs, ui_mode);
+    }
+    nyns_interp *interp = nyns_create();
+    if (!interp) {
+        std::cerr << "Error: cannot create interpreter\n";
+        return 1;
+    }
+    nyns_set_ui_mode(interp, ui_mode);
+    run_entry(interp, scripts[0]);
+    nyns_destroy(interp);
     return 0;
 }
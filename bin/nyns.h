@@ -0,0 +1,106 @@
+/* C interface to the nyns interpreter library (bin/libnyns.cpp).
+ *
+ * Build the library and the command-line front end with, for example:
+ *
+ *   g++ -std=c++17 -O2 -fPIC -pthread -shared bin/libnyns.cpp -o libnyns.so
+ *   g++ -std=c++17 -O2 -pthread bin/nyns.cpp bin/libnyns.cpp -o bin/nyns_cpp
+ *
+ * An interpreter holds everything a script can change: the TUI buttons and
+ * display text, and its own working directory, which 'moveto' changes
+ * without touching the process working directory. Separate interpreters may
+ * run scripts on separate threads at the same time; a single interpreter
+ * must only be used by one thread at a time.
+ */
+#ifndef NYNS_H
+#define NYNS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nyns_interp nyns_interp;
+
+/* Receives `len` bytes of output. The bytes are not NUL-terminated. */
+typedef void (*nyns_write_fn)(void *user, const char *data, size_t len);
+
+/* Creates an interpreter whose working directory is the process working
+ * directory at the time of the call. Returns NULL on allocation failure. */
+nyns_interp *nyns_create(void);
+
+void nyns_destroy(nyns_interp *interp);
+
+/* Redirects standard output or error text to `fn`. By default output goes
+ * to file descriptors 1 and 2. Passing NULL restores the default. What
+ * commands run by 'adm' write to a redirected stream is read through a pipe
+ * and passed to `fn` as well. */
+void nyns_set_output(nyns_interp *interp, nyns_write_fn fn, void *user);
+void nyns_set_error(nyns_interp *interp, nyns_write_fn fn, void *user);
+
+/* Changes the interpreter's working directory, relative to its current
+ * one, as 'moveto' would. Returns 0 on success and -1 with errno set. */
+int nyns_set_cwd(nyns_interp *interp, const char *dir);
+
+/* Each run returns 0 on success and -1 if the script could not be read or
+ * compiled. Errors inside a script are reported to the error output and do
+ * not stop it. All output has been delivered when a run returns. */
+int nyns_run_file(nyns_interp *interp, const char *path);
+int nyns_run_buffer(nyns_interp *interp, const char *data, size_t len);
+
+/* Executes commands from `fd` line by line as they arrive, until EOF. */
+int nyns_run_fd(nyns_interp *interp, int fd);
+
+/* Process-wide: stores compiled scripts in `dir`, or when `dir` is NULL in
+ * $NYNS_CACHE_DIR, $XDG_CACHE_HOME/nyns or ~/.cache/nyns. Call before any
+ * script runs. */
+void nyns_enable_cache(const char *dir);
+
+/* Process-wide: the most background 'adm' jobs one interpreter keeps
+ * running at once; starting another waits for a slot. 0, the default,
+ * means 16. */
+void nyns_set_job_limit(unsigned limit);
+
+/* Process-wide: the TUI is drawn once per batch of consecutive UI commands
+ * (button, display). With `fps` > 0 it is also redrawn at most that many
+ * times a second while such a batch runs. The default, 0, disables that. */
+void nyns_set_frame_rate(unsigned fps);
+
+/* How an interpreter shows the TUI: */
+enum {
+    NYNS_UI_TERMINAL = 0, /* Redrawn in place with ANSI escapes (default) */
+    NYNS_UI_EVENTS = 1,   /* A plain line per display text or selection change */
+    NYNS_UI_FINAL = 2     /* Once as plain text, at the end of a run that changed it */
+};
+
+/* Selects one of the NYNS_UI_* modes for `interp`. Each interpreter has its
+ * own, so one process can serve terminals and logs side by side. */
+void nyns_set_ui_mode(nyns_interp *interp, int mode);
+
+/* Gives the size, in character cells, of the terminal that `interp`'s
+ * output reaches, for output redirected by nyns_set_output(); 0 for either
+ * means no limit. From then on the interpreter ignores the size of
+ * standard output, which it otherwise only asks for when output is not
+ * redirected. May be called from another thread during a run, and a TUI
+ * waiting in nyns_run_fd() for input is redrawn at once. */
+void nyns_set_terminal_size(nyns_interp *interp, unsigned rows, unsigned cols);
+
+/* Tells interpreters that the terminal was resized; async-signal-safe.
+ * The library watches SIGWINCH itself unless a handler for it is already
+ * installed when it first draws the TUI, so only programs that handle
+ * SIGWINCH themselves need to call this from their handler. */
+void nyns_terminal_resized(void);
+
+/* Process-wide: when `enable` is nonzero, each run that drew the TUI ends by
+ * reporting on its error stream how many frames, bytes and writes that took. */
+void nyns_set_frame_stats(int enable);
+
+/* Writes `entry` with all of its imports inlined to `output_path`, or to
+ * standard output when it is NULL. Returns 0 on success, -1 on failure. */
+int nyns_bundle(const char *entry, const char *output_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NYNS_H */